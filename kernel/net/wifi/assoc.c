@@ -176,9 +176,7 @@ static inline int match_bss_no_security(struct lbs_802_11_security *secinfo,
 {
 	if (!secinfo->wep_enabled  && !secinfo->WPAenabled
 	    && !secinfo->WPA2enabled
-	    && match_bss->wpa_ie[0] != MFIE_TYPE_GENERIC
-	    && match_bss->rsn_ie[0] != MFIE_TYPE_RSN
-	    && !(match_bss->capability & WLAN_CAPABILITY_PRIVACY))
+	    && !match_bss->secclass)
 		return 1;
 	else
 		return 0;
@@ -189,7 +187,7 @@ static inline int match_bss_static_wep(struct lbs_802_11_security *secinfo,
 {
 	if (secinfo->wep_enabled && !secinfo->WPAenabled
 	    && !secinfo->WPA2enabled
-	    && (match_bss->capability & WLAN_CAPABILITY_PRIVACY))
+	    && (match_bss->secclass & LBS_BSS_SEC_PRIVACY))
 		return 1;
 	else
 		return 0;
@@ -199,7 +197,7 @@ static inline int match_bss_wpa(struct lbs_802_11_security *secinfo,
 				struct bss_descriptor *match_bss)
 {
 	if (!secinfo->wep_enabled && secinfo->WPAenabled
-	    && (match_bss->wpa_ie[0] == MFIE_TYPE_GENERIC)
+	    && (match_bss->secclass & LBS_BSS_SEC_WPA)
 	    /* privacy bit may NOT be set in some APs like LinkSys WRT54G
 	    && (match_bss->capability & WLAN_CAPABILITY_PRIVACY) */
 	   )
@@ -212,7 +210,7 @@ static inline int match_bss_wpa2(struct lbs_802_11_security *secinfo,
 				 struct bss_descriptor *match_bss)
 {
 	if (!secinfo->wep_enabled && secinfo->WPA2enabled &&
-	    (match_bss->rsn_ie[0] == MFIE_TYPE_RSN)
+	    (match_bss->secclass & LBS_BSS_SEC_RSN)
 	    /* privacy bit may NOT be set in some APs like LinkSys WRT54G
 	    (match_bss->capability & WLAN_CAPABILITY_PRIVACY) */
 	   )
@@ -226,9 +224,7 @@ static inline int match_bss_dynamic_wep(struct lbs_802_11_security *secinfo,
 {
 	if (!secinfo->wep_enabled && !secinfo->WPAenabled
 	    && !secinfo->WPA2enabled
-	    && (match_bss->wpa_ie[0] != MFIE_TYPE_GENERIC)
-	    && (match_bss->rsn_ie[0] != MFIE_TYPE_RSN)
-	    && (match_bss->capability & WLAN_CAPABILITY_PRIVACY))
+	    && (match_bss->secclass == LBS_BSS_SEC_PRIVACY))
 		return 1;
 	else
 		return 0;
@@ -330,6 +326,7 @@ static struct bss_descriptor *lbs_find_bssid_in_list(struct lbs_private *priv,
 {
 	struct bss_descriptor *iter_bss;
 	struct bss_descriptor *found_bss = NULL;
+	struct hlist_node *node;
 
 	lbs_deb_enter(LBS_DEB_SCAN);
 
@@ -343,7 +340,10 @@ static struct bss_descriptor *lbs_find_bssid_in_list(struct lbs_private *priv,
 	 *   is an AP with multiple SSIDs assigned to the same BSSID
 	 */
 	mutex_lock(&priv->lock);
-	list_for_each_entry(iter_bss, &priv->network_list, list) {
+	priv->scan_lookup.bssid_lookups++;
+	hlist_for_each_entry(iter_bss, node, lbs_bssid_bucket(priv, bssid),
+			     bssid_node) {
+		priv->scan_lookup.steps++;
 		if (compare_ether_addr(iter_bss->bssid, bssid))
 			continue; /* bssid doesn't match */
 		switch (mode) {
@@ -385,17 +385,16 @@ static struct bss_descriptor *lbs_find_ssid_in_list(struct lbs_private *priv,
 	u32 bestrssi = 0;
 	struct bss_descriptor *iter_bss = NULL;
 	struct bss_descriptor *found_bss = NULL;
-	struct bss_descriptor *tmp_oldest = NULL;
+	struct hlist_node *node;
 
 	lbs_deb_enter(LBS_DEB_SCAN);
 
 	mutex_lock(&priv->lock);
 
-	list_for_each_entry(iter_bss, &priv->network_list, list) {
-		if (!tmp_oldest ||
-		    (iter_bss->last_scanned < tmp_oldest->last_scanned))
-			tmp_oldest = iter_bss;
-
+	priv->scan_lookup.ssid_lookups++;
+	hlist_for_each_entry(iter_bss, node,
+			     lbs_ssid_bucket(priv, ssid, ssid_len), ssid_node) {
+		priv->scan_lookup.steps++;
 		if (lbs_ssid_cmp(iter_bss->ssid, iter_bss->ssid_len,
 				 ssid, ssid_len) != 0)
 			continue; /* ssid doesn't match */
@@ -1214,39 +1213,37 @@ struct assoc_request *lbs_get_association_request(struct lbs_private *priv)
 
 
 /**
- *  @brief This function finds common rates between rate1 and card rates.
+ *  @brief This function finds common rates between a BSS and card rates.
  *
- * It will fill common rates in rate1 as output if found.
+ * It will fill the common rates, in card rate table order, in rates.
  *
  * NOTE: Setting the MSB of the basic rates need to be taken
  *   care, either before or after calling this function
  *
- *  @param priv     A pointer to struct lbs_private structure
- *  @param rate1       the buffer which keeps input and output
- *  @param rate1_size  the size of rate1 buffer; new size of buffer on return
+ *  @param priv        A pointer to struct lbs_private structure
+ *  @param rate_bitmap the BSS rate bitmap worked out at scan time
+ *  @param rates       the output buffer
+ *  @param rates_size  the size of rates buffer; new size of buffer on return
  *
  *  @return            0 or -1
  */
 static int get_common_rates(struct lbs_private *priv,
+	u16 rate_bitmap,
 	u8 *rates,
 	u16 *rates_size)
 {
-	u8 *card_rates = lbs_bg_rates;
-	size_t num_card_rates = sizeof(lbs_bg_rates);
-	int ret = 0, i, j;
-	u8 tmp[30];
+	int ret = 0, i;
+	u8 tmp[MAX_RATES];
 	size_t tmp_size = 0;
 
-	/* For each rate in card_rates that exists in rate1, copy to tmp */
-	for (i = 0; card_rates[i] && (i < num_card_rates); i++) {
-		for (j = 0; rates[j] && (j < *rates_size); j++) {
-			if (rates[j] == card_rates[i])
-				tmp[tmp_size++] = card_rates[i];
-		}
+	for (i = 0; i < MAX_RATES && lbs_bg_rates[i]; i++) {
+		if (rate_bitmap & (1 << i))
+			tmp[tmp_size++] = lbs_bg_rates[i];
 	}
 
-	lbs_deb_hex(LBS_DEB_JOIN, "AP rates    ", rates, *rates_size);
-	lbs_deb_hex(LBS_DEB_JOIN, "card rates  ", card_rates, num_card_rates);
+	lbs_deb_join("BSS rate bitmap 0x%04x\n", rate_bitmap);
+	lbs_deb_hex(LBS_DEB_JOIN, "card rates  ", lbs_bg_rates,
+		    sizeof(lbs_bg_rates));
 	lbs_deb_hex(LBS_DEB_JOIN, "common rates", tmp, tmp_size);
 	lbs_deb_join("TX data rate 0x%02x\n", priv->cur_rate);
 
@@ -1436,9 +1433,8 @@ int lbs_cmd_80211_associate(struct lbs_private *priv,
 
 	rates = (struct mrvlietypes_ratesparamset *) pos;
 	rates->header.type = cpu_to_le16(TLV_TYPE_RATES);
-	memcpy(&rates->rates, &bss->rates, MAX_RATES);
 	tmplen = MAX_RATES;
-	if (get_common_rates(priv, rates->rates, &tmplen)) {
+	if (get_common_rates(priv, bss->rate_bitmap, rates->rates, &tmplen)) {
 		ret = -1;
 		goto done;
 	}
@@ -1657,11 +1653,10 @@ int lbs_cmd_80211_ad_hoc_join(struct lbs_private *priv,
 
 	priv->curbssparams.channel = bss->channel;
 
-	/* Copy Data rates from the rates recorded in scan response */
-	memset(join_cmd->bss.rates, 0, sizeof(join_cmd->bss.rates));
+	/* Data rates from the rate bitmap recorded in scan response */
 	ratesize = min_t(u16, sizeof(join_cmd->bss.rates), MAX_RATES);
-	memcpy(join_cmd->bss.rates, bss->rates, ratesize);
-	if (get_common_rates(priv, join_cmd->bss.rates, &ratesize)) {
+	if (get_common_rates(priv, bss->rate_bitmap, join_cmd->bss.rates,
+			     &ratesize)) {
 		lbs_deb_join("ADHOC_J_CMD: get_common_rates returns error.\n");
 		ret = -1;
 		goto done;
@@ -1797,13 +1792,10 @@ int lbs_ret_80211_associate(struct lbs_private *priv,
 	priv->SNR[TYPE_RXPD][TYPE_AVG] = 0;
 	priv->NF[TYPE_RXPD][TYPE_AVG] = 0;
 
-	memset(priv->rawSNR, 0x00, sizeof(priv->rawSNR));
-	memset(priv->rawNF, 0x00, sizeof(priv->rawNF));
-	priv->nextSNRNF = 0;
-	priv->numSNRNF = 0;
+	lbs_reset_snr_nf(priv);
 
 	netif_carrier_on(priv->dev);
-	if (!priv->tx_pending_len)
+	if (!lbs_tx_ring_full(priv))
 		netif_wake_queue(priv->dev);
 
 	memcpy(wrqu.ap_addr.sa_data, priv->curbssparams.bssid, ETH_ALEN);
@@ -1886,7 +1878,7 @@ int lbs_ret_80211_ad_hoc_start(struct lbs_private *priv,
 	priv->curbssparams.ssid_len = bss->ssid_len;
 
 	netif_carrier_on(priv->dev);
-	if (!priv->tx_pending_len)
+	if (!lbs_tx_ring_full(priv))
 		netif_wake_queue(priv->dev);
 
 	memset(&wrqu, 0, sizeof(wrqu));
@@ -1119,11 +1119,94 @@ static int lbs_cmd_bcn_ctrl(struct lbs_private * priv,
 	return 0;
 }
 
+/**
+ *  @brief Returns the scheduling class of a command. Read-only queries
+ *  don't change firmware state, so they may overtake anything queued
+ *  before them; everything else keeps its submission order.
+ *
+ *  @param cmd      A pointer to the command header
+ *  @return 	   LBS_CMD_PRIO_QUERY or LBS_CMD_PRIO_NORMAL
+ */
+static u8 lbs_cmd_prio(struct cmd_header *cmd)
+{
+	switch (le16_to_cpu(cmd->command)) {
+	case CMD_802_11_RSSI:
+	case CMD_802_11_GET_LOG:
+	case CMD_802_11_GET_STAT:
+	case CMD_GET_TSF:
+		return LBS_CMD_PRIO_QUERY;
+	default:
+		return LBS_CMD_PRIO_NORMAL;
+	}
+}
+
+/**
+ *  @brief Finds the cmd_stats slot of a command, claiming a free one
+ *  the first time a command is seen. Requires priv->driver_lock held.
+ *
+ *  @param priv     A pointer to struct lbs_private structure
+ *  @param command  Command code
+ *  @return 	   The slot, or NULL if all slots are taken
+ */
+static struct lbs_cmd_stats *lbs_cmd_stats_slot(struct lbs_private *priv,
+						u16 command)
+{
+	int i;
+
+	for (i = 0; i < LBS_CMD_STATS_SLOTS; i++) {
+		if (priv->cmd_stats[i].command == command)
+			return &priv->cmd_stats[i];
+		if (!priv->cmd_stats[i].command) {
+			priv->cmd_stats[i].command = command;
+			return &priv->cmd_stats[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ *  @brief Finds a queued, not yet submitted command that a new request
+ *  for the same command can be folded into. Only idempotent commands
+ *  whose response just updates driver state qualify; the newer request
+ *  always carries the complete state, so it may replace the queued one.
+ *  Only nodes still on cmdpendingq match: lbs_execute_next_command()
+ *  unlinks a node under the same lock as it picks it for submission.
+ *  Requires priv->driver_lock held.
+ *
+ *  @param priv     A pointer to struct lbs_private structure
+ *  @param command  Command code of the new request
+ *  @param callback Response callback of the new request
+ *  @return 	   The queued command, or NULL
+ */
+static struct cmd_ctrl_node *lbs_find_queued_cmd(struct lbs_private *priv,
+	u16 command,
+	int (*callback)(struct lbs_private *, unsigned long, struct cmd_header *))
+{
+	struct cmd_ctrl_node *cmdnode;
+
+	switch (command) {
+	case CMD_802_11_RSSI:
+	case CMD_802_11_GET_LOG:
+	case CMD_MAC_CONTROL:
+	case CMD_MAC_MULTICAST_ADR:
+		break;
+	default:
+		return NULL;
+	}
+
+	list_for_each_entry(cmdnode, &priv->cmdpendingq, list) {
+		if (le16_to_cpu(cmdnode->cmdbuf->command) == command &&
+		    cmdnode->callback == callback && !cmdnode->callback_arg)
+			return cmdnode;
+	}
+	return NULL;
+}
+
 static void lbs_queue_cmd(struct lbs_private *priv,
 			  struct cmd_ctrl_node *cmdnode)
 {
+	struct cmd_ctrl_node *iter;
 	unsigned long flags;
-	int addtail = 1;
 
 	lbs_deb_enter(LBS_DEB_HOST);
 
@@ -1136,6 +1219,7 @@ static void lbs_queue_cmd(struct lbs_private *priv,
 		goto done;
 	}
 	cmdnode->result = 0;
+	cmdnode->prio = lbs_cmd_prio(cmdnode->cmdbuf);
 
 	/* Exit_PS command needs to be queued in the header always. */
 	if (le16_to_cpu(cmdnode->cmdbuf->command) == CMD_802_11_PS_MODE) {
@@ -1143,16 +1227,21 @@ static void lbs_queue_cmd(struct lbs_private *priv,
 
 		if (psm->action == cpu_to_le16(CMD_SUBCMD_EXIT_PS)) {
 			if (priv->psstate != PS_STATE_FULL_POWER)
-				addtail = 0;
+				cmdnode->prio = LBS_CMD_PRIO_URGENT;
 		}
 	}
 
 	spin_lock_irqsave(&priv->driver_lock, flags);
 
-	if (addtail)
-		list_add_tail(&cmdnode->list, &priv->cmdpendingq);
-	else
-		list_add(&cmdnode->list, &priv->cmdpendingq);
+	cmdnode->queued = ktime_get();
+
+	/* Queue behind the last command of the same or a higher class */
+	list_for_each_entry_reverse(iter, &priv->cmdpendingq, list) {
+		if (iter->prio <= cmdnode->prio)
+			break;
+		priv->cmd_jumped++;
+	}
+	list_add(&cmdnode->list, &iter->list);
 
 	spin_unlock_irqrestore(&priv->driver_lock, flags);
 
@@ -1168,22 +1257,31 @@ static void lbs_submit_command(struct lbs_private *priv,
 {
 	unsigned long flags;
 	struct cmd_header *cmd;
+	struct lbs_cmd_stats *stats;
 	uint16_t cmdsize;
 	uint16_t command;
 	int timeo = 3 * HZ;
+	u32 wait;
 	int ret;
 
 	lbs_deb_enter(LBS_DEB_HOST);
 
 	cmd = cmdnode->cmdbuf;
 
+	cmdsize = le16_to_cpu(cmd->size);
+	command = le16_to_cpu(cmd->command);
+
 	spin_lock_irqsave(&priv->driver_lock, flags);
 	priv->cur_cmd = cmdnode;
 	priv->cur_cmd_retcode = 0;
-	spin_unlock_irqrestore(&priv->driver_lock, flags);
 
-	cmdsize = le16_to_cpu(cmd->size);
-	command = le16_to_cpu(cmd->command);
+	wait = lbs_usecs_since(cmdnode->queued);
+	lbs_hist_add(&priv->cmd_class_wait[cmdnode->prio], wait);
+	stats = lbs_cmd_stats_slot(priv, command);
+	if (stats)
+		lbs_hist_add(&stats->wait, wait);
+	cmdnode->submitted = ktime_get();
+	spin_unlock_irqrestore(&priv->driver_lock, flags);
 
 	/* These commands take longer */
 	if (command == CMD_802_11_SCAN || command == CMD_802_11_ASSOCIATE ||
@@ -1223,6 +1321,7 @@ static void __lbs_cleanup_and_insert_cmd(struct lbs_private *priv,
 
 	cmdnode->callback = NULL;
 	cmdnode->callback_arg = 0;
+	cmdnode->async = 0;
 
 	memset(cmdnode->cmdbuf, 0, LBS_CMD_BUFFER_SIZE);
 
@@ -1244,14 +1343,23 @@ static void lbs_cleanup_and_insert_cmd(struct lbs_private *priv,
 void lbs_complete_command(struct lbs_private *priv, struct cmd_ctrl_node *cmd,
 			  int result)
 {
-	if (cmd == priv->cur_cmd)
+	struct lbs_cmd_stats *stats;
+
+	if (cmd == priv->cur_cmd) {
 		priv->cur_cmd_retcode = result;
+		stats = lbs_cmd_stats_slot(priv,
+				le16_to_cpu(cmd->cmdbuf->command));
+		if (stats)
+			lbs_hist_add(&stats->exec,
+				     lbs_usecs_since(cmd->submitted));
+	}
 
 	cmd->result = result;
 	cmd->cmdwaitqwoken = 1;
+	cmd->completions++;
 	wake_up_interruptible(&cmd->cmdwait_q);
 
-	if (!cmd->callback || cmd->callback == lbs_cmd_async_callback)
+	if ((!cmd->callback || cmd->async) && !cmd->waiters)
 		__lbs_cleanup_and_insert_cmd(priv, cmd);
 	priv->cur_cmd = NULL;
 }
@@ -1310,6 +1418,48 @@ void lbs_set_mac_control(struct lbs_private *priv)
 	lbs_deb_leave(LBS_DEB_CMD);
 }
 
+/**
+ *  @brief Waits for a queued command that a request was folded into
+ *  and returns its result. The node is kept off the free queue while
+ *  merged callers wait on it; the last one to leave recycles it.
+ *
+ *  @param priv		A pointer to struct lbs_private structure
+ *  @param cmdnode	The queued command
+ *  @param completions	cmdnode->completions when the request was merged
+ *  @return 		0, or -1 if the command failed or the wait
+ *  			was interrupted
+ */
+static int lbs_wait_merged_cmd(struct lbs_private *priv,
+			       struct cmd_ctrl_node *cmdnode, u32 completions)
+{
+	unsigned long flags;
+	int done, ret;
+
+	might_sleep();
+	wait_event_interruptible(cmdnode->cmdwait_q,
+				 cmdnode->cmdwaitqwoken);
+
+	spin_lock_irqsave(&priv->driver_lock, flags);
+	done = cmdnode->completions != completions;
+	if (!done) {
+		/* a signal, or the card went away */
+		lbs_deb_host("PREP_CMD: merged command 0x%04x not completed\n",
+			     le16_to_cpu(cmdnode->cmdbuf->command));
+		ret = -1;
+	} else if (cmdnode->result) {
+		lbs_deb_host("PREP_CMD: merged command failed with return "
+			     "code %d\n", cmdnode->result);
+		ret = -1;
+	} else
+		ret = 0;
+
+	if (--cmdnode->waiters == 0 && done)
+		__lbs_cleanup_and_insert_cmd(priv, cmdnode);
+	spin_unlock_irqrestore(&priv->driver_lock, flags);
+
+	return ret;
+}
+
 /**
  *  @brief This function prepare the command before send to firmware.
  *
@@ -1330,6 +1480,7 @@ int lbs_prepare_and_send_command(struct lbs_private *priv,
 	struct cmd_ctrl_node *cmdnode;
 	struct cmd_ds_command *cmdptr;
 	unsigned long flags;
+	u32 completions = 0;
 
 	lbs_deb_enter(LBS_DEB_HOST);
 
@@ -1345,6 +1496,26 @@ int lbs_prepare_and_send_command(struct lbs_private *priv,
 		goto done;
 	}
 
+	/* Piggyback on an identical request that is still queued */
+	cmdnode = NULL;
+	if (!pdata_buf) {
+		spin_lock_irqsave(&priv->driver_lock, flags);
+		cmdnode = lbs_find_queued_cmd(priv, cmd_no, NULL);
+		if (cmdnode) {
+			priv->cmd_merged++;
+			completions = cmdnode->completions;
+			if (wait_option & CMD_OPTION_WAITFORRSP)
+				cmdnode->waiters++;
+		}
+		spin_unlock_irqrestore(&priv->driver_lock, flags);
+	}
+	if (cmdnode) {
+		lbs_deb_host("PREP_CMD: merged command 0x%04x\n", cmd_no);
+		if (wait_option & CMD_OPTION_WAITFORRSP)
+			ret = lbs_wait_merged_cmd(priv, cmdnode, completions);
+		goto done;
+	}
+
 	cmdnode = lbs_get_cmd_ctrl_node(priv);
 
 	if (cmdnode == NULL) {
@@ -1667,6 +1838,20 @@ static struct cmd_ctrl_node *lbs_get_cmd_ctrl_node(struct lbs_private *priv)
  *  @param priv     A pointer to struct lbs_private structure
  *  @return 	   0 or -1
  */
+/**
+ *  @brief Puts a command taken off cmdpendingq by
+ *  lbs_execute_next_command() back at its head.
+ */
+static void lbs_requeue_cmd(struct lbs_private *priv,
+			    struct cmd_ctrl_node *cmdnode)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&priv->driver_lock, flags);
+	list_add(&cmdnode->list, &priv->cmdpendingq);
+	spin_unlock_irqrestore(&priv->driver_lock, flags);
+}
+
 int lbs_execute_next_command(struct lbs_private *priv)
 {
 	struct cmd_ctrl_node *cmdnode = NULL;
@@ -1688,9 +1873,15 @@ int lbs_execute_next_command(struct lbs_private *priv)
 		goto done;
 	}
 
+	/*
+	 * Take the node off the queue right away, so lbs_queue_cmd() and
+	 * the merge paths never see one that is about to be submitted.
+	 * Paths that can't send it yet put it back at the head.
+	 */
 	if (!list_empty(&priv->cmdpendingq)) {
 		cmdnode = list_first_entry(&priv->cmdpendingq,
 					   struct cmd_ctrl_node, list);
+		list_del_init(&cmdnode->list);
 	}
 
 	spin_unlock_irqrestore(&priv->driver_lock, flags);
@@ -1705,6 +1896,7 @@ int lbs_execute_next_command(struct lbs_private *priv)
 				       "EXEC_NEXT_CMD: cannot send cmd 0x%04x in psstate %d\n",
 				       le16_to_cpu(cmd->command),
 				       priv->psstate);
+				lbs_requeue_cmd(priv, cmdnode);
 				ret = -1;
 				goto done;
 			}
@@ -1731,9 +1923,12 @@ int lbs_execute_next_command(struct lbs_private *priv)
 				    ) {
 					/* w/ new scheme, it will not reach here.
 					   since it is blocked in main_thread. */
+					lbs_requeue_cmd(priv, cmdnode);
 					priv->needtowakeup = 1;
-				} else
+				} else {
+					lbs_requeue_cmd(priv, cmdnode);
 					lbs_ps_wakeup(priv, 0);
+				}
 
 				ret = 0;
 				goto done;
@@ -1751,7 +1946,6 @@ int lbs_execute_next_command(struct lbs_private *priv)
 				    cpu_to_le16(CMD_SUBCMD_EXIT_PS)) {
 					lbs_deb_host(
 					       "EXEC_NEXT_CMD: ignore ENTER_PS cmd\n");
-					list_del(&cmdnode->list);
 					spin_lock_irqsave(&priv->driver_lock, flags);
 					lbs_complete_command(priv, cmdnode, 0);
 					spin_unlock_irqrestore(&priv->driver_lock, flags);
@@ -1764,7 +1958,6 @@ int lbs_execute_next_command(struct lbs_private *priv)
 				    (priv->psstate == PS_STATE_PRE_SLEEP)) {
 					lbs_deb_host(
 					       "EXEC_NEXT_CMD: ignore EXIT_PS cmd in sleep\n");
-					list_del(&cmdnode->list);
 					spin_lock_irqsave(&priv->driver_lock, flags);
 					lbs_complete_command(priv, cmdnode, 0);
 					spin_unlock_irqrestore(&priv->driver_lock, flags);
@@ -1778,7 +1971,6 @@ int lbs_execute_next_command(struct lbs_private *priv)
 				       "EXEC_NEXT_CMD: sending EXIT_PS\n");
 			}
 		}
-		list_del(&cmdnode->list);
 		lbs_deb_host("EXEC_NEXT_CMD: sending command 0x%04x\n",
 			    le16_to_cpu(cmd->command));
 		lbs_submit_command(priv, cmdnode);
@@ -1956,9 +2148,10 @@ void lbs_ps_confirm_sleep(struct lbs_private *priv)
 static struct cmd_ctrl_node *__lbs_cmd_async(struct lbs_private *priv,
 	uint16_t command, struct cmd_header *in_cmd, int in_cmd_size,
 	int (*callback)(struct lbs_private *, unsigned long, struct cmd_header *),
-	unsigned long callback_arg)
+	unsigned long callback_arg, int async)
 {
-	struct cmd_ctrl_node *cmdnode;
+	struct cmd_ctrl_node *cmdnode = NULL;
+	unsigned long flags;
 
 	lbs_deb_enter(LBS_DEB_HOST);
 
@@ -1968,6 +2161,38 @@ static struct cmd_ctrl_node *__lbs_cmd_async(struct lbs_private *priv,
 		goto done;
 	}
 
+	/*
+	 * Fire-and-forget requests for an idempotent command replace a copy
+	 * that hasn't been sent yet instead of taking another buffer.
+	 */
+	if (async) {
+		spin_lock_irqsave(&priv->driver_lock, flags);
+		cmdnode = lbs_find_queued_cmd(priv, command, callback);
+		if (cmdnode) {
+			if (le16_to_cpu(cmdnode->cmdbuf->size) == in_cmd_size &&
+			    !memcmp(&cmdnode->cmdbuf[1], &in_cmd[1],
+				    in_cmd_size - sizeof(*in_cmd)))
+				priv->cmd_merged++;
+			else
+				priv->cmd_superseded++;
+
+			memcpy(cmdnode->cmdbuf, in_cmd, in_cmd_size);
+			priv->seqnum++;
+			cmdnode->cmdbuf->command = cpu_to_le16(command);
+			cmdnode->cmdbuf->size    = cpu_to_le16(in_cmd_size);
+			cmdnode->cmdbuf->seqnum  = cpu_to_le16(priv->seqnum);
+			cmdnode->cmdbuf->result  = 0;
+		}
+		spin_unlock_irqrestore(&priv->driver_lock, flags);
+
+		if (cmdnode) {
+			lbs_deb_host("PREP_CMD: merged command 0x%04x\n",
+				     command);
+			wake_up_interruptible(&priv->waitq);
+			goto done;
+		}
+	}
+
 	cmdnode = lbs_get_cmd_ctrl_node(priv);
 	if (cmdnode == NULL) {
 		lbs_deb_host("PREP_CMD: cmdnode is NULL\n");
@@ -1980,6 +2205,7 @@ static struct cmd_ctrl_node *__lbs_cmd_async(struct lbs_private *priv,
 
 	cmdnode->callback = callback;
 	cmdnode->callback_arg = callback_arg;
+	cmdnode->async = async;
 
 	/* Copy the incoming command to the buffer */
 	memcpy(cmdnode->cmdbuf, in_cmd, in_cmd_size);
@@ -2007,10 +2233,32 @@ void lbs_cmd_async(struct lbs_private *priv, uint16_t command,
 {
 	lbs_deb_enter(LBS_DEB_CMD);
 	__lbs_cmd_async(priv, command, in_cmd, in_cmd_size,
-		lbs_cmd_async_callback, 0);
+		lbs_cmd_async_callback, 0, 1);
 	lbs_deb_leave(LBS_DEB_CMD);
 }
 
+/**
+ *  @brief Queues a command without waiting for it. The callback is run
+ *  from the main thread if the command succeeds; callback_arg must not
+ *  point to the caller's stack.
+ *
+ *  @return 	   0, or a negative error if the command wasn't queued
+ */
+int lbs_cmd_async_cb(struct lbs_private *priv, uint16_t command,
+	struct cmd_header *in_cmd, int in_cmd_size,
+	int (*callback)(struct lbs_private *, unsigned long, struct cmd_header *),
+	unsigned long callback_arg)
+{
+	struct cmd_ctrl_node *cmdnode;
+
+	lbs_deb_enter(LBS_DEB_CMD);
+	cmdnode = __lbs_cmd_async(priv, command, in_cmd, in_cmd_size,
+		callback, callback_arg, 1);
+	lbs_deb_leave(LBS_DEB_CMD);
+
+	return IS_ERR(cmdnode) ? PTR_ERR(cmdnode) : 0;
+}
+
 int __lbs_cmd(struct lbs_private *priv, uint16_t command,
 	      struct cmd_header *in_cmd, int in_cmd_size,
 	      int (*callback)(struct lbs_private *, unsigned long, struct cmd_header *),
@@ -2023,7 +2271,7 @@ int __lbs_cmd(struct lbs_private *priv, uint16_t command,
 	lbs_deb_enter(LBS_DEB_HOST);
 
 	cmdnode = __lbs_cmd_async(priv, command, in_cmd, in_cmd_size,
-				  callback, callback_arg);
+				  callback, callback_arg, 0);
 	if (IS_ERR(cmdnode)) {
 		ret = PTR_ERR(cmdnode);
 		goto done;
@@ -48,18 +48,13 @@ void lbs_mac_event_disconnected(struct lbs_private *priv)
 	netif_carrier_off(priv->dev);
 
 	/* Free Tx and Rx packets */
-	kfree_skb(priv->currenttxskb);
-	priv->currenttxskb = NULL;
-	priv->tx_pending_len = 0;
+	lbs_tx_ring_flush(priv);
 
 	/* reset SNR/NF/RSSI values */
 	memset(priv->SNR, 0x00, sizeof(priv->SNR));
 	memset(priv->NF, 0x00, sizeof(priv->NF));
 	memset(priv->RSSI, 0x00, sizeof(priv->RSSI));
-	memset(priv->rawSNR, 0x00, sizeof(priv->rawSNR));
-	memset(priv->rawNF, 0x00, sizeof(priv->rawNF));
-	priv->nextSNRNF = 0;
-	priv->numSNRNF = 0;
+	lbs_reset_snr_nf(priv);
 	priv->connect_status = LBS_DISCONNECTED;
 
 	/* Clear out associated SSID and BSSID since connection is
@@ -662,11 +657,11 @@ int lbs_process_event(struct lbs_private *priv, u32 event)
 		priv->mesh_connect_status = LBS_CONNECTED;
 		if (priv->mesh_open) {
 			netif_carrier_on(priv->mesh_dev);
-			if (!priv->tx_pending_len)
+			if (!lbs_tx_ring_full(priv))
 				netif_wake_queue(priv->mesh_dev);
 		}
 		priv->mode = IW_MODE_ADHOC;
-		schedule_work(&priv->sync_channel);
+		queue_work(priv->work_thread, &priv->sync_channel);
 		break;
 
 	default:
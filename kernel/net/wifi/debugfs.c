@@ -2,15 +2,20 @@
 #include <linux/dcache.h>
 #include <linux/debugfs.h>
 #include <linux/delay.h>
+#include <linux/kfifo.h>
 #include <linux/mm.h>
 #include <linux/string.h>
+#include <linux/vmalloc.h>
 #include <net/iw_handler.h>
+#include <asm/div64.h>
 
 #include "dev.h"
 #include "decl.h"
 #include "host.h"
 #include "debugfs.h"
 #include "cmd.h"
+#include "scan.h"
+#include "hist.h"
 
 static struct dentry *lbs_dir;
 static char *szStates[] = {
@@ -36,6 +41,51 @@ static ssize_t write_file_dummy(struct file *file, const char __user *buf,
 
 static const size_t len = PAGE_SIZE;
 
+/**
+ *  @brief Formats a histogram into a debugfs text buffer, one line
+ *  per non-empty bucket.
+ *
+ *  @param buf     Output buffer
+ *  @param size    Space left in buf
+ *  @param name    Title of the histogram
+ *  @param unit    Unit of the recorded values
+ *  @param hist    Histogram to print
+ *  @return 	   Number of characters written
+ */
+size_t lbs_hist_print(char *buf, size_t size, const char *name,
+		      const char *unit, struct lbs_hist *hist)
+{
+	size_t pos = 0;
+	u64 avg = hist->sum;
+	int i;
+
+	if (hist->count)
+		do_div(avg, hist->count);
+
+	pos += scnprintf(buf+pos, size-pos,
+			"%s: count %u, avg %llu %s, max %u %s\n", name,
+			hist->count, (unsigned long long) avg, unit,
+			hist->max, unit);
+
+	for (i = 0; i < LBS_HIST_BUCKETS; i++) {
+		if (!hist->bucket[i])
+			continue;
+		if (i == 0)
+			pos += scnprintf(buf+pos, size-pos, "  %10u       : %u\n",
+					0, hist->bucket[i]);
+		else if (i == LBS_HIST_BUCKETS - 1)
+			pos += scnprintf(buf+pos, size-pos, "  %10u+      : %u\n",
+					1 << (i - 1), hist->bucket[i]);
+		else
+			pos += scnprintf(buf+pos, size-pos, "  %10u-%-6u: %u\n",
+					1 << (i - 1), (1 << i) - 1,
+					hist->bucket[i]);
+	}
+
+	return pos;
+}
+EXPORT_SYMBOL_GPL(lbs_hist_print);
+
 static ssize_t lbs_dev_info(struct file *file, char __user *userbuf,
 				  size_t count, loff_t *ppos)
 {
@@ -56,6 +106,428 @@ static ssize_t lbs_dev_info(struct file *file, char __user *userbuf,
 	return res;
 }
 
+static ssize_t lbs_tx_stats(struct file *file, char __user *userbuf,
+				  size_t count, loff_t *ppos)
+{
+	struct lbs_private *priv = file->private_data;
+	size_t pos = 0;
+	unsigned long addr = get_zeroed_page(GFP_KERNEL);
+	char *buf = (char *)addr;
+	ssize_t res;
+
+	pos += snprintf(buf+pos, len-pos, "ring = %u/%u\n",
+				priv->tx_ring_count, priv->tx_ring_size);
+	pos += snprintf(buf+pos, len-pos, "nocopy = %u\n", priv->tx_nocopy);
+	pos += snprintf(buf+pos, len-pos, "copy_headroom = %u\n",
+				priv->tx_copy_headroom);
+	pos += snprintf(buf+pos, len-pos, "copy_monitor = %u\n",
+				priv->tx_copy_monitor);
+	pos += snprintf(buf+pos, len-pos, "copy_iface = %u\n",
+				priv->tx_copy_iface);
+
+	res = simple_read_from_buffer(userbuf, count, ppos, buf, pos);
+
+	free_page(addr);
+	return res;
+}
+
+static ssize_t lbs_signal_stats(struct file *file, char __user *userbuf,
+				  size_t count, loff_t *ppos)
+{
+	struct lbs_private *priv = file->private_data;
+	size_t pos = 0;
+	unsigned long addr = get_zeroed_page(GFP_KERNEL);
+	char *buf = (char *)addr;
+	u32 n, sum_snr, sum_nf, sqsum_snr, sqsum_nf, samples;
+	u8 min_snr, max_snr, min_nf, max_nf;
+	ssize_t res;
+
+	/* RX updates these without locking; a torn snapshot is harmless */
+	n = priv->numSNRNF;
+	sum_snr = priv->sumSNR;
+	sum_nf = priv->sumNF;
+	sqsum_snr = priv->sqsumSNR;
+	sqsum_nf = priv->sqsumNF;
+	min_snr = priv->minSNR;
+	max_snr = priv->maxSNR;
+	min_nf = priv->minNF;
+	max_nf = priv->maxNF;
+	samples = priv->samplesSNRNF;
+
+	pos += snprintf(buf+pos, len-pos, "samples = %u\n", samples);
+	pos += snprintf(buf+pos, len-pos, "window = %u/%u\n",
+				n, DEFAULT_DATA_AVG_FACTOR);
+	if (samples && n) {
+		pos += snprintf(buf+pos, len-pos,
+			"snr: avg %u min %u max %u var %u\n",
+			sum_snr / n, min_snr, max_snr,
+			(n * sqsum_snr - sum_snr * sum_snr) / (n * n));
+		pos += snprintf(buf+pos, len-pos,
+			"nf: avg %u min %u max %u var %u\n",
+			sum_nf / n, min_nf, max_nf,
+			(n * sqsum_nf - sum_nf * sum_nf) / (n * n));
+		pos += snprintf(buf+pos, len-pos, "rssi: avg %u last %u\n",
+			priv->RSSI[TYPE_RXPD][TYPE_AVG],
+			priv->RSSI[TYPE_RXPD][TYPE_NOAVG]);
+	}
+
+	pos += snprintf(buf+pos, len-pos, "log_refreshes = %u\n",
+				priv->stats_refreshes);
+	if (priv->stats_time)
+		pos += snprintf(buf+pos, len-pos, "log_age = %u ms\n",
+			jiffies_to_msecs(jiffies - priv->stats_time));
+
+	res = simple_read_from_buffer(userbuf, count, ppos, buf, pos);
+
+	free_page(addr);
+	return res;
+}
+
+static ssize_t lbs_scan_lookup_read(struct file *file, char __user *userbuf,
+				  size_t count, loff_t *ppos)
+{
+	struct lbs_private *priv = file->private_data;
+	struct lbs_scan_lookup_stats *stats = &priv->scan_lookup;
+	size_t pos = 0;
+	unsigned long addr = get_zeroed_page(GFP_KERNEL);
+	char *buf = (char *)addr;
+	u64 hash_ns, list_ns;
+	ssize_t res;
+
+	mutex_lock(&priv->lock);
+	hash_ns = stats->bench_hash_ns;
+	list_ns = stats->bench_list_ns;
+	if (stats->bench_entries) {
+		do_div(hash_ns, stats->bench_entries);
+		do_div(list_ns, stats->bench_entries);
+	}
+
+	pos += snprintf(buf+pos, len-pos, "bssid_lookups = %u\n",
+				stats->bssid_lookups);
+	pos += snprintf(buf+pos, len-pos, "ssid_lookups = %u\n",
+				stats->ssid_lookups);
+	pos += snprintf(buf+pos, len-pos, "merge_lookups = %u\n",
+				stats->merge_lookups);
+	pos += snprintf(buf+pos, len-pos, "compares = %u\n", stats->steps);
+	pos += snprintf(buf+pos, len-pos, "bench_rounds = %u\n",
+				stats->bench_rounds);
+	pos += snprintf(buf+pos, len-pos, "bench_lookups = %u\n",
+				stats->bench_entries);
+	pos += snprintf(buf+pos, len-pos, "bench_hash_ns = %llu\n",
+				(unsigned long long)hash_ns);
+	pos += snprintf(buf+pos, len-pos, "bench_list_ns = %llu\n",
+				(unsigned long long)list_ns);
+	mutex_unlock(&priv->lock);
+
+	res = simple_read_from_buffer(userbuf, count, ppos, buf, pos);
+
+	free_page(addr);
+	return res;
+}
+
+/*
+ * Writing a number N runs N passes of hashed and linear lookups over the
+ * current scan table; the read side then shows the per-lookup cost.
+ */
+static ssize_t lbs_scan_lookup_write(struct file *file,
+				const char __user *user_buf, size_t count,
+				loff_t *ppos)
+{
+	struct lbs_private *priv = file->private_data;
+	ssize_t buf_size, ret;
+	unsigned int rounds;
+	unsigned long addr = get_zeroed_page(GFP_KERNEL);
+	char *buf = (char *)addr;
+
+	buf_size = min(count, len - 1);
+	if (copy_from_user(buf, user_buf, buf_size)) {
+		ret = -EFAULT;
+		goto out_unlock;
+	}
+	if (sscanf(buf, "%u", &rounds) != 1 || !rounds || rounds > 10000) {
+		ret = -EINVAL;
+		goto out_unlock;
+	}
+
+	lbs_scan_lookup_bench(priv, rounds);
+	ret = count;
+
+out_unlock:
+	free_page(addr);
+	return ret;
+}
+
+static ssize_t lbs_scan_merge_read(struct file *file, char __user *userbuf,
+				  size_t count, loff_t *ppos)
+{
+	struct lbs_private *priv = file->private_data;
+	struct lbs_scan_merge_stats *stats = &priv->scan_merge;
+	size_t pos = 0;
+	unsigned long addr = get_zeroed_page(GFP_KERNEL);
+	char *buf = (char *)addr;
+	ssize_t res;
+
+	mutex_lock(&priv->lock);
+	pos += snprintf(buf+pos, len-pos, "chunks = %u\n", stats->chunks);
+	pos += snprintf(buf+pos, len-pos, "added = %u\n", stats->added);
+	pos += snprintf(buf+pos, len-pos, "updated = %u\n", stats->updated);
+	pos += snprintf(buf+pos, len-pos, "expired = %u\n", stats->expired);
+	pos += snprintf(buf+pos, len-pos, "evicted = %u\n", stats->evicted);
+	pos += lbs_hist_print(buf+pos, len-pos, "merge time", "us",
+			      &stats->time);
+	mutex_unlock(&priv->lock);
+
+	res = simple_read_from_buffer(userbuf, count, ppos, buf, pos);
+
+	free_page(addr);
+	return res;
+}
+
+/* Copy of the command statistics, taken under driver_lock */
+struct lbs_cmd_stats_snap {
+	u32 jumped;
+	u32 merged;
+	u32 superseded;
+	struct lbs_hist class_wait[LBS_CMD_PRIO_NR];
+	struct lbs_cmd_stats stats[LBS_CMD_STATS_SLOTS];
+};
+
+#define LBS_CMD_STATS_BUFSIZE	(128 + (LBS_CMD_PRIO_NR + \
+				 2 * LBS_CMD_STATS_SLOTS) * LBS_HIST_PRINT_MAX)
+
+static ssize_t lbs_cmd_stats_read(struct file *file, char __user *userbuf,
+				  size_t count, loff_t *ppos)
+{
+	static const char *class_names[LBS_CMD_PRIO_NR] = {
+		"wait_urgent", "wait_query", "wait_normal",
+	};
+	struct lbs_private *priv = file->private_data;
+	struct lbs_cmd_stats_snap *snap;
+	size_t pos = 0, size = LBS_CMD_STATS_BUFSIZE;
+	char *buf;
+	unsigned long flags;
+	char name[16];
+	ssize_t res;
+	int i;
+
+	snap = kmalloc(sizeof(*snap), GFP_KERNEL);
+	buf = vmalloc(size);
+	if (!snap || !buf) {
+		res = -ENOMEM;
+		goto out;
+	}
+
+	/* Only copy under the lock, the formatting is done outside it */
+	spin_lock_irqsave(&priv->driver_lock, flags);
+	snap->jumped = priv->cmd_jumped;
+	snap->merged = priv->cmd_merged;
+	snap->superseded = priv->cmd_superseded;
+	memcpy(snap->class_wait, priv->cmd_class_wait,
+	       sizeof(snap->class_wait));
+	memcpy(snap->stats, priv->cmd_stats, sizeof(snap->stats));
+	spin_unlock_irqrestore(&priv->driver_lock, flags);
+
+	pos += scnprintf(buf+pos, size-pos, "jumped = %u\n", snap->jumped);
+	pos += scnprintf(buf+pos, size-pos, "merged = %u\n", snap->merged);
+	pos += scnprintf(buf+pos, size-pos, "superseded = %u\n",
+			 snap->superseded);
+	for (i = 0; i < LBS_CMD_PRIO_NR; i++)
+		pos += lbs_hist_print(buf+pos, size-pos, class_names[i], "us",
+				      &snap->class_wait[i]);
+	for (i = 0; i < LBS_CMD_STATS_SLOTS; i++) {
+		struct lbs_cmd_stats *stats = &snap->stats[i];
+
+		if (!stats->command)
+			break;
+		snprintf(name, sizeof(name), "0x%04x wait", stats->command);
+		pos += lbs_hist_print(buf+pos, size-pos, name, "us",
+				      &stats->wait);
+		snprintf(name, sizeof(name), "0x%04x exec", stats->command);
+		pos += lbs_hist_print(buf+pos, size-pos, name, "us",
+				      &stats->exec);
+	}
+
+	res = simple_read_from_buffer(userbuf, count, ppos, buf, pos);
+
+out:
+	vfree(buf);
+	kfree(snap);
+	return res;
+}
+
+static ssize_t lbs_monitor_read(struct file *file, char __user *userbuf,
+				size_t count, loff_t *ppos)
+{
+	struct lbs_private *priv = file->private_data;
+	struct net_device_stats *stats = &priv->rtap_stats;
+	size_t pos = 0;
+	unsigned long addr = get_zeroed_page(GFP_KERNEL);
+	char *buf = (char *)addr;
+	ssize_t res;
+	int i;
+
+	pos += snprintf(buf+pos, len-pos, "enabled = %d\n", priv->monitormode);
+	pos += snprintf(buf+pos, len-pos, "rx_packets = %lu\n",
+			stats->rx_packets);
+	pos += snprintf(buf+pos, len-pos, "rx_bytes = %lu\n", stats->rx_bytes);
+	pos += snprintf(buf+pos, len-pos, "rx_dropped = %lu\n",
+			stats->rx_dropped);
+	pos += snprintf(buf+pos, len-pos, "rx_errors = %lu\n",
+			stats->rx_errors);
+	pos += snprintf(buf+pos, len-pos, "rx_reallocs = %u\n",
+			priv->rtap_rx_reallocs);
+	pos += snprintf(buf+pos, len-pos, "hop_channels = %d\n",
+			priv->hop_nr);
+	pos += snprintf(buf+pos, len-pos, "hops = %u\n", priv->hops);
+	pos += snprintf(buf+pos, len-pos, "hop_failures = %u\n",
+			priv->hop_failures);
+
+	pos += snprintf(buf+pos, len-pos, "channel  frames      bytes\n");
+	for (i = 0; i <= LBS_MONITOR_MAX_CHANNEL; i++) {
+		struct lbs_rtap_chan_stats *chan = &priv->rtap_chan_stats[i];
+
+		if (!chan->frames)
+			continue;
+		if (i)
+			pos += snprintf(buf+pos, len-pos, "%7d", i);
+		else
+			pos += snprintf(buf+pos, len-pos, "      ?");
+		pos += snprintf(buf+pos, len-pos, " %7u %10llu\n",
+				chan->frames,
+				(unsigned long long) chan->bytes);
+	}
+
+	res = simple_read_from_buffer(userbuf, count, ppos, buf, pos);
+
+	free_page(addr);
+	return res;
+}
+
+#ifdef LBS_LOCK_STATS
+static ssize_t lbs_lock_stats_read(struct file *file, char __user *userbuf,
+				   size_t count, loff_t *ppos)
+{
+	struct lbs_private *priv = file->private_data;
+	struct lbs_lock_stats driver, tx;
+	size_t pos = 0;
+	unsigned long addr = get_zeroed_page(GFP_KERNEL);
+	char *buf = (char *)addr;
+	unsigned long flags;
+	ssize_t res;
+
+	/* Snapshot each one under its own lock, without counting it */
+	spin_lock_irqsave(&priv->driver_lock, flags);
+	driver = priv->driver_lock_stats;
+	spin_unlock_irqrestore(&priv->driver_lock, flags);
+
+	spin_lock_irqsave(&priv->tx_lock, flags);
+	tx = priv->tx_lock_stats;
+	spin_unlock_irqrestore(&priv->tx_lock, flags);
+
+	pos += scnprintf(buf+pos, len-pos, "driver_lock contended = %u\n",
+			 driver.contended);
+	pos += lbs_hist_print(buf+pos, len-pos, "driver_lock hold", "ns",
+			      &driver.hold);
+	pos += scnprintf(buf+pos, len-pos, "tx_lock contended = %u\n",
+			 tx.contended);
+	pos += lbs_hist_print(buf+pos, len-pos, "tx_lock hold", "ns",
+			      &tx.hold);
+	pos += scnprintf(buf+pos, len-pos, "event_fifo = %u\n",
+			 __kfifo_len(priv->event_fifo));
+
+	res = simple_read_from_buffer(userbuf, count, ppos, buf, pos);
+
+	free_page(addr);
+	return res;
+}
+#endif
+
+#ifdef LBS_TX_TRACE
+static const char *lbs_tx_stage_names[LBS_TX_STAGE_NR] = {
+	"xmit", "dequeue", "worker", "io_rdy", "written", "done",
+};
+
+static ssize_t lbs_tx_trace_read(struct file *file, char __user *userbuf,
+				 size_t count, loff_t *ppos)
+{
+	struct lbs_private *priv = file->private_data;
+	struct lbs_tx_trace *trace = &priv->tx_trace;
+	size_t pos = 0;
+	unsigned long addr = get_zeroed_page(GFP_KERNEL);
+	char *buf = (char *)addr;
+	unsigned long flags;
+	char name[24];
+	ssize_t res;
+	int i;
+
+	spin_lock_irqsave(&trace->lock, flags);
+	pos += scnprintf(buf+pos, len-pos, "frames = %u\n", trace->next_seq);
+	for (i = 1; i < LBS_TX_STAGE_NR; i++) {
+		snprintf(name, sizeof(name), "%s->%s",
+			 lbs_tx_stage_names[i - 1], lbs_tx_stage_names[i]);
+		pos += lbs_hist_print(buf+pos, len-pos, name, "us",
+				      &trace->stage[i]);
+	}
+	pos += lbs_hist_print(buf+pos, len-pos, "total", "us", &trace->total);
+	pos += lbs_hist_print(buf+pos, len-pos, "queue_stopped", "us",
+			      &trace->stopped);
+	spin_unlock_irqrestore(&trace->lock, flags);
+
+	res = simple_read_from_buffer(userbuf, count, ppos, buf, pos);
+
+	free_page(addr);
+	return res;
+}
+
+/*
+ * One line per frame still in the ring, oldest first: sequence number,
+ * length, then the usecs from XMIT to each later stage ("-" if the
+ * frame hasn't reached it).
+ */
+static ssize_t lbs_tx_trace_raw_read(struct file *file, char __user *userbuf,
+				     size_t count, loff_t *ppos)
+{
+	struct lbs_private *priv = file->private_data;
+	struct lbs_tx_trace *trace = &priv->tx_trace;
+	struct lbs_tx_trace_rec *rec;
+	size_t pos = 0;
+	unsigned long addr = get_zeroed_page(GFP_KERNEL);
+	char *buf = (char *)addr;
+	unsigned long flags;
+	ssize_t res;
+	u32 seq;
+	int i;
+
+	pos += scnprintf(buf+pos, len-pos, "seq len");
+	for (i = 1; i < LBS_TX_STAGE_NR; i++)
+		pos += scnprintf(buf+pos, len-pos, " %s",
+				 lbs_tx_stage_names[i]);
+	pos += scnprintf(buf+pos, len-pos, "\n");
+
+	spin_lock_irqsave(&trace->lock, flags);
+	seq = trace->next_seq - min_t(u32, trace->next_seq, LBS_TX_TRACE_LEN);
+	for (; seq != trace->next_seq; seq++) {
+		rec = &trace->ring[seq % LBS_TX_TRACE_LEN];
+		pos += scnprintf(buf+pos, len-pos, "%u %u", rec->seq, rec->len);
+		for (i = 1; i < LBS_TX_STAGE_NR; i++) {
+			if (rec->stamped & (1 << i))
+				pos += scnprintf(buf+pos, len-pos, " %u",
+					lbs_usecs_between(
+						rec->t[LBS_TX_STAGE_XMIT],
+						rec->t[i]));
+			else
+				pos += scnprintf(buf+pos, len-pos, " -");
+		}
+		pos += scnprintf(buf+pos, len-pos, "\n");
+	}
+	spin_unlock_irqrestore(&trace->lock, flags);
+
+	res = simple_read_from_buffer(userbuf, count, ppos, buf, pos);
+
+	free_page(addr);
+	return res;
+}
+#endif
 
 static ssize_t lbs_getscantable(struct file *file, char __user *userbuf,
 				  size_t count, loff_t *ppos)
@@ -99,6 +571,124 @@ static ssize_t lbs_getscantable(struct file *file, char __user *userbuf,
 	return res;
 }
 
+/*
+ * Binary scan table export.  Each open file has its own snapshot in a
+ * vmalloc_user() buffer, taken at open and again on every read from
+ * offset 0, so a poller can keep the file open and either pread() it or
+ * mmap() it once and, after each re-read, check seq and the generation.
+ */
+struct lbs_scan_snap {
+	struct lbs_private *priv;
+	struct mutex lock;
+	void *buf;
+	size_t len;
+	size_t size;
+};
+
+#define LBS_SCAN_SNAP_SIZE \
+	PAGE_ALIGN(sizeof(struct lbs_scan_export_hdr) + \
+		   MAX_NETWORK_COUNT * sizeof(struct lbs_scan_export_rec))
+
+static void lbs_scan_snap_fill(struct lbs_scan_snap *snap)
+{
+	struct lbs_private *priv = snap->priv;
+	struct lbs_scan_export_hdr *hdr = snap->buf;
+	struct lbs_scan_export_rec *rec = (void *)(hdr + 1);
+	struct bss_descriptor *iter_bss;
+	u32 count = 0;
+
+	/* Readers of a mapping see an odd seq until the rewrite is done */
+	hdr->seq++;
+	smp_wmb();
+
+	mutex_lock(&priv->lock);
+	list_for_each_entry(iter_bss, &priv->network_list, list) {
+		if (count == MAX_NETWORK_COUNT)
+			break;
+		memcpy(rec->bssid, iter_bss->bssid, ETH_ALEN);
+		rec->channel = iter_bss->channel;
+		rec->signal = -(int)iter_bss->rssi;
+		rec->capability = iter_bss->capability;
+		rec->secclass = iter_bss->secclass;
+		rec->ssid_len = iter_bss->ssid_len;
+		rec->age = jiffies_to_msecs(jiffies - iter_bss->last_scanned);
+		memset(rec->ssid, 0, sizeof(rec->ssid));
+		memcpy(rec->ssid, iter_bss->ssid,
+		       min_t(u8, iter_bss->ssid_len, IW_ESSID_MAX_SIZE));
+		rec++;
+		count++;
+	}
+	hdr->generation = priv->scan_gen;
+	mutex_unlock(&priv->lock);
+
+	hdr->version = LBS_SCAN_EXPORT_VERSION;
+	hdr->rec_size = sizeof(*rec);
+	hdr->count = count;
+	snap->len = (void *)rec - snap->buf;
+
+	smp_wmb();
+	hdr->seq++;
+}
+
+static int lbs_scan_table_open(struct inode *inode, struct file *file)
+{
+	struct lbs_scan_snap *snap;
+
+	snap = kzalloc(sizeof(*snap), GFP_KERNEL);
+	if (!snap)
+		return -ENOMEM;
+
+	snap->size = LBS_SCAN_SNAP_SIZE;
+	snap->buf = vmalloc_user(snap->size);
+	if (!snap->buf) {
+		kfree(snap);
+		return -ENOMEM;
+	}
+	snap->priv = inode->i_private;
+	mutex_init(&snap->lock);
+	lbs_scan_snap_fill(snap);
+
+	file->private_data = snap;
+	return 0;
+}
+
+static ssize_t lbs_scan_table_read(struct file *file, char __user *userbuf,
+				   size_t count, loff_t *ppos)
+{
+	struct lbs_scan_snap *snap = file->private_data;
+	ssize_t res;
+
+	mutex_lock(&snap->lock);
+	if (*ppos == 0)
+		lbs_scan_snap_fill(snap);
+	res = simple_read_from_buffer(userbuf, count, ppos, snap->buf,
+				      snap->len);
+	mutex_unlock(&snap->lock);
+
+	return res;
+}
+
+static int lbs_scan_table_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct lbs_scan_snap *snap = file->private_data;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	/* other readers share the buffer, so no mprotect() to writable */
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	return remap_vmalloc_range(vma, snap->buf, vma->vm_pgoff);
+}
+
+static int lbs_scan_table_release(struct inode *inode, struct file *file)
+{
+	struct lbs_scan_snap *snap = file->private_data;
+
+	vfree(snap->buf);
+	kfree(snap);
+	return 0;
+}
+
 static ssize_t lbs_sleepparams_write(struct file *file,
 				const char __user *user_buf, size_t count,
 				loff_t *ppos)
@@ -688,8 +1278,30 @@ static struct lbs_debugfs_files debugfs_files[] = {
 	{ "info", 0444, FOPS(lbs_dev_info, write_file_dummy), },
 	{ "getscantable", 0444, FOPS(lbs_getscantable,
 					write_file_dummy), },
+	{ "scan_table", 0444, {
+		.owner = THIS_MODULE,
+		.open = lbs_scan_table_open,
+		.read = lbs_scan_table_read,
+		.mmap = lbs_scan_table_mmap,
+		.release = lbs_scan_table_release,
+	}, },
 	{ "sleepparams", 0644, FOPS(lbs_sleepparams_read,
 				lbs_sleepparams_write), },
+	{ "tx_stats", 0444, FOPS(lbs_tx_stats, write_file_dummy), },
+	{ "signal", 0444, FOPS(lbs_signal_stats, write_file_dummy), },
+	{ "scan_lookup", 0644, FOPS(lbs_scan_lookup_read,
+				lbs_scan_lookup_write), },
+	{ "scan_merge", 0444, FOPS(lbs_scan_merge_read, write_file_dummy), },
+	{ "cmd_stats", 0444, FOPS(lbs_cmd_stats_read, write_file_dummy), },
+	{ "monitor", 0444, FOPS(lbs_monitor_read, write_file_dummy), },
+#ifdef LBS_LOCK_STATS
+	{ "lock_stats", 0444, FOPS(lbs_lock_stats_read, write_file_dummy), },
+#endif
+#ifdef LBS_TX_TRACE
+	{ "tx_trace", 0444, FOPS(lbs_tx_trace_read, write_file_dummy), },
+	{ "tx_trace_raw", 0444, FOPS(lbs_tx_trace_raw_read,
+				write_file_dummy), },
+#endif
 };
 
 static struct lbs_debugfs_files debugfs_events_files[] = {
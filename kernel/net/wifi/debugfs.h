@@ -7,4 +7,35 @@ void lbs_debugfs_remove(void);
 void lbs_debugfs_init_one(struct lbs_private *priv, struct net_device *dev);
 void lbs_debugfs_remove_one(struct lbs_private *priv);
 
+/*
+ * Layout of the binary "scan_table" debugfs file: one header followed by
+ * count fixed size records, in host byte order.  The file can be read in
+ * one go or mmap()ed; generation changes whenever the scan table does.
+ *
+ * A mapping is rewritten in place by every read from offset 0.  seq is
+ * odd while that happens and bumped again once it is done, so a reader
+ * of the mapping loads seq, copies what it needs and retries if seq was
+ * odd or has changed since.
+ */
+#define LBS_SCAN_EXPORT_VERSION		2
+
+struct lbs_scan_export_hdr {
+	u16 version;
+	u16 rec_size;
+	u32 generation;
+	u32 count;
+	u32 seq;
+} __attribute__ ((packed));
+
+struct lbs_scan_export_rec {
+	u8 bssid[ETH_ALEN];
+	u8 channel;
+	s8 signal;		/* dBm */
+	u16 capability;
+	u8 secclass;		/* LBS_BSS_SEC_* */
+	u8 ssid_len;
+	u32 age;		/* msecs since the BSS was last seen */
+	u8 ssid[IW_ESSID_MAX_SIZE];
+} __attribute__ ((packed));
+
 #endif
@@ -16,6 +16,7 @@ struct sk_buff;
 struct net_device;
 struct cmd_ctrl_node;
 struct cmd_ds_command;
+struct cmd_ds_802_11_get_log;
 
 void lbs_set_mac_control(struct lbs_private *priv);
 
@@ -43,9 +44,33 @@ int lbs_process_command_response(struct lbs_private *priv, u8 *data, u32 len);
 void lbs_complete_command(struct lbs_private *priv, struct cmd_ctrl_node *cmd,
 			  int result);
 int lbs_hard_start_xmit(struct sk_buff *skb, struct net_device *dev);
+int lbs_tx_ring_send(struct lbs_private *priv);
+void lbs_tx_ring_flush(struct lbs_private *priv);
+
+#ifdef LBS_TX_TRACE
+void lbs_tx_trace_init(struct lbs_private *priv);
+void lbs_tx_trace_start(struct lbs_private *priv, struct sk_buff *skb);
+void lbs_tx_trace_stamp(struct lbs_private *priv, u32 first, u32 last,
+	int stage);
+void lbs_tx_trace_done(struct lbs_private *priv);
+void lbs_tx_trace_stop(struct lbs_private *priv);
+void lbs_tx_trace_wake(struct lbs_private *priv);
+#else
+static inline void lbs_tx_trace_init(struct lbs_private *priv) {}
+static inline void lbs_tx_trace_start(struct lbs_private *priv,
+	struct sk_buff *skb) {}
+static inline void lbs_tx_trace_stamp(struct lbs_private *priv, u32 first,
+	u32 last, int stage) {}
+static inline void lbs_tx_trace_done(struct lbs_private *priv) {}
+static inline void lbs_tx_trace_stop(struct lbs_private *priv) {}
+static inline void lbs_tx_trace_wake(struct lbs_private *priv) {}
+#endif
 int lbs_set_regiontable(struct lbs_private *priv, u8 region, u8 band);
 
 int lbs_process_rxed_packet(struct lbs_private *priv, struct sk_buff *);
+void lbs_reset_snr_nf(struct lbs_private *priv);
+int lbs_get_cached_log(struct lbs_private *priv,
+	struct cmd_ds_802_11_get_log *log);
 
 void lbs_ps_sleep(struct lbs_private *priv, int wait_option);
 void lbs_ps_confirm_sleep(struct lbs_private *priv);
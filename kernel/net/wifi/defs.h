@@ -10,6 +10,8 @@
 #ifdef CONFIG_LIBERTAS_DEBUG
 #define DEBUG
 #define PROC_DEBUG
+#define LBS_LOCK_STATS
+#define LBS_TX_TRACE
 #endif
 
 #ifndef DRV_NAME
@@ -141,6 +143,31 @@ static inline void lbs_deb_hex(unsigned int grp, const char *prompt, u8 *buf, in
 #define MRVDRV_SNAP_HEADER_LEN          8
 
 #define	LBS_UPLD_SIZE			2312
+#define LBS_TX_RING_DEPTH		8
+#define LBS_TX_RING_MAX_DEPTH		64
+
+/** Scan table index: buckets for the BSSID and SSID hashes */
+#define LBS_BSS_HASH_BITS		6
+#define LBS_BSS_HASH_SIZE		(1 << LBS_BSS_HASH_BITS)
+/** Scan table slots: one spare so a scan response always has a free
+ *  slot to be parsed into before it is known to be a new BSS */
+#define LBS_BSS_SLOTS			(MAX_NETWORK_COUNT + 1)
+
+/** Command scheduling classes, highest priority first */
+#define LBS_CMD_PRIO_URGENT		0	/* Exit_PS */
+#define LBS_CMD_PRIO_QUERY		1	/* read-only queries */
+#define LBS_CMD_PRIO_NORMAL		2
+#define LBS_CMD_PRIO_NR			3
+/** Distinct command codes tracked in the cmd_stats debugfs file */
+#define LBS_CMD_STATS_SLOTS		16
+
+/** Monitor-mode channel hopping, dwell times in msecs */
+#define LBS_MONITOR_MAX_CHANNEL		14
+#define LBS_HOP_MAX_CHANNELS		LBS_MONITOR_MAX_CHANNEL
+#define LBS_HOP_DWELL_DEFAULT		200
+#define LBS_HOP_DWELL_MIN		10
+#define LBS_HOP_DWELL_MAX		10000
+
 #define DEV_NAME_LEN			32
 
 /* Wake criteria for HOST_SLEEP_CFG command */
@@ -316,7 +343,9 @@ enum PS_STATE {
 enum DNLD_STATE {
 	DNLD_RES_RECEIVED,
 	DNLD_DATA_SENT,
-	DNLD_CMD_SENT
+	DNLD_CMD_SENT,
+	/* IF layer holds data for an aggregate; only more data may follow */
+	DNLD_DATA_COLLECTING
 };
 
 /** LBS_MEDIA_STATE */
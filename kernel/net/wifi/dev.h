@@ -10,11 +10,13 @@
 #include <linux/wireless.h>
 #include <linux/ethtool.h>
 #include <linux/debugfs.h>
+#include <linux/seqlock.h>
 #include <net/ieee80211.h>
 #include <net/compat.h>
 
 #include "defs.h"
 #include "hostcmd.h"
+#include "hist.h"
 
 extern struct ethtool_ops lbs_ethtool_ops;
 
@@ -99,6 +101,83 @@ struct lbs_mesh_stats {
 	u32	tx_failed_cnt;		/* Tx:  Failed transmissions */
 };
 
+/** Scan table lookup counters, see the scan_lookup debugfs file */
+struct lbs_scan_lookup_stats {
+	u32 bssid_lookups;
+	u32 ssid_lookups;
+	u32 merge_lookups;
+	u32 steps;		/* entries compared across all lookups */
+	u32 bench_rounds;
+	u32 bench_entries;
+	u64 bench_hash_ns;
+	u64 bench_list_ns;
+};
+
+/** Per command code timings, see the cmd_stats debugfs file */
+struct lbs_cmd_stats {
+	u16 command;		/* 0 if the slot is unused */
+	struct lbs_hist wait;	/* usecs from lbs_queue_cmd() to submit */
+	struct lbs_hist exec;	/* usecs from submit to completion */
+};
+
+/** Lock hold times and contention, see the lock_stats debugfs file */
+struct lbs_lock_stats {
+	u32 contended;		/* acquisitions that had to spin */
+	struct lbs_hist hold;	/* nsecs between lock and unlock */
+	ktime_t taken;
+};
+
+/** Points a data frame passes on its way to the card, in order */
+enum lbs_tx_stage {
+	LBS_TX_STAGE_XMIT,	/* lined up by lbs_hard_start_xmit() */
+	LBS_TX_STAGE_DEQUEUE,	/* taken off the ring by lbs_thread() */
+	LBS_TX_STAGE_WORKER,	/* picked up by the IF layer's worker */
+	LBS_TX_STAGE_IO_RDY,	/* card ready to take it */
+	LBS_TX_STAGE_WRITTEN,	/* transfer to the card finished */
+	LBS_TX_STAGE_DONE,	/* card acknowledged the download */
+	LBS_TX_STAGE_NR,
+};
+
+#ifdef LBS_TX_TRACE
+#define LBS_TX_TRACE_LEN	64
+
+struct lbs_tx_trace_rec {
+	u32 seq;
+	u16 len;
+	u16 stamped;		/* bit per lbs_tx_stage reached */
+	ktime_t t[LBS_TX_STAGE_NR];
+};
+
+/** TX latency trace, see the tx_trace and tx_trace_raw debugfs files */
+struct lbs_tx_trace {
+	spinlock_t lock;
+	u32 next_seq;		/* given to the next frame */
+	u32 written_seq;	/* frames before this one reached the card */
+	u32 done_seq;		/* frames before this one were acknowledged */
+	struct lbs_tx_trace_rec ring[LBS_TX_TRACE_LEN];
+	struct lbs_hist stage[LBS_TX_STAGE_NR];	/* usecs from the stage before */
+	struct lbs_hist total;			/* usecs from XMIT to DONE */
+	struct lbs_hist stopped;		/* usecs the queues were stopped */
+	ktime_t stopped_at;
+};
+#endif
+
+/** Frames captured on one channel in monitor mode */
+struct lbs_rtap_chan_stats {
+	u32 frames;
+	u64 bytes;
+};
+
+/** Scan-response merge cost, see the scan_merge debugfs file */
+struct lbs_scan_merge_stats {
+	u32 chunks;		/* scan responses merged */
+	u32 added;
+	u32 updated;
+	u32 expired;		/* aged out past DEFAULT_MAX_SCAN_AGE */
+	u32 evicted;		/* oldest dropped because the table was full */
+	struct lbs_hist time;	/* usecs per response chunk */
+};
+
 /** Private structure for the MV device */
 struct lbs_private {
 	int mesh_open;
@@ -111,6 +190,23 @@ struct lbs_private {
 	struct net_device *dev;
 
 	struct net_device_stats stats;
+	/* frames captured on rtap_net_dev */
+	struct net_device_stats rtap_stats;
+	u32 rtap_rx_reallocs;		/* skb grown for the radiotap header */
+	/* indexed by channel, 0 for frames on an unknown channel */
+	struct lbs_rtap_chan_stats rtap_chan_stats[LBS_MONITOR_MAX_CHANNEL + 1];
+	/* channel and frequency tagged on captured frames */
+	u8 rtap_chan;
+	u16 rtap_freq;
+
+	/* Monitor-mode channel hopper, see lbs_rtap_hop_set() */
+	struct delayed_work hop_work;
+	u8 hop_chan[LBS_HOP_MAX_CHANNELS];
+	u16 hop_dwell[LBS_HOP_MAX_CHANNELS];	/* msecs */
+	int hop_nr;
+	int hop_idx;
+	u32 hops;
+	u32 hop_failures;
 	struct net_device *mesh_dev; /* Virtual device */
 	struct net_device *rtap_net_dev;
 
@@ -118,7 +214,7 @@ struct lbs_private {
 	struct lbs_mesh_stats mstats;
 	struct dentry *debugfs_dir;
 	struct dentry *debugfs_debug;
-	struct dentry *debugfs_files[6];
+	struct dentry *debugfs_files[16];
 
 	struct dentry *events_dir;
 	struct dentry *debugfs_events_files[6];
@@ -147,6 +243,14 @@ struct lbs_private {
 	struct delayed_work scan_work;
 	struct delayed_work assoc_work;
 	struct work_struct sync_channel;
+
+	/** Cached GET_LOG for wireless stats, see lbs_get_cached_log() */
+	struct delayed_work stats_work;
+	seqlock_t stats_lock;
+	struct cmd_ds_802_11_get_log stats_log;
+	unsigned long stats_time;	/* jiffies of last refresh, 0 if none */
+	u32 stats_refreshes;
+	int stats_read;		/* cache read since the last refresh */
 	/* remember which channel was scanned last, != 0 if currently scanning */
 	int scan_channel;
 	u8 scan_ssid[IW_ESSID_MAX_SIZE + 1];
@@ -154,6 +258,11 @@ struct lbs_private {
 
 	/** Hardware access */
 	int (*hw_host_to_card) (struct lbs_private *priv, u8 type, u8 *payload, u16 nb);
+	/* optional, consumes a data skb whose txpd is already in place,
+	   also when it fails */
+	int (*hw_host_to_card_skb) (struct lbs_private *priv, struct sk_buff *skb);
+	/* headroom the interface needs in front of the txpd */
+	unsigned int hw_tx_headroom;
 	void (*reset_card) (struct lbs_private *priv);
 
 	/* Wake On LAN */
@@ -168,11 +277,25 @@ struct lbs_private {
 
 	struct mutex lock;
 
-	/* TX packet ready to be sent... */
-	int tx_pending_len;		/* -1 while building packet */
+	/* TX packets lined up to be sent, protected by tx_lock.
+	   Each skb already carries its txpd in the headroom. The
+	   full/ready tests may be made without the lock; the thread
+	   rechecks under it before popping. */
+	struct sk_buff **tx_ring;
+	unsigned int tx_ring_size;
+	unsigned int tx_ring_head;	/* next slot to fill */
+	unsigned int tx_ring_tail;	/* next slot to send */
+	unsigned int tx_ring_count;
+
+#ifdef LBS_TX_TRACE
+	struct lbs_tx_trace tx_trace;
+#endif
 
-	u8 tx_pending_buf[LBS_UPLD_SIZE];
-	/* protected by hard_start_xmit serialization */
+	/* TX copy accounting */
+	u32 tx_nocopy;			/* headers built in place */
+	u32 tx_copy_headroom;		/* skb reallocated for headroom */
+	u32 tx_copy_monitor;		/* copy sent, original kept for feedback */
+	u32 tx_copy_iface;		/* copied or reallocated by the interface */
 
 	/** command-related variables */
 	u16 seqnum;
@@ -184,8 +307,14 @@ struct lbs_private {
 	/** command Queues */
 	/** Free command buffers */
 	struct list_head cmdfreeq;
-	/** Pending command buffers */
+	/** Pending command buffers, ordered by cmd_ctrl_node->prio */
 	struct list_head cmdpendingq;
+	/** Command timings, protected by driver_lock */
+	struct lbs_cmd_stats cmd_stats[LBS_CMD_STATS_SLOTS];
+	struct lbs_hist cmd_class_wait[LBS_CMD_PRIO_NR];
+	u32 cmd_jumped;		/* queued commands overtaken by a query */
+	u32 cmd_merged;		/* requests folded into an identical one */
+	u32 cmd_superseded;	/* queued requests replaced by a newer one */
 
 	wait_queue_head_t cmd_pending;
 
@@ -194,14 +323,24 @@ struct lbs_private {
 	u8 resp_buf[2][LBS_UPLD_SIZE];
 	u32 resp_len[2];
 
-	/* Events sent from hardware to driver */
+	/* Events sent from hardware to driver. The IF layer is the only
+	   producer and lbs_thread() the only consumer, so the fifo is
+	   used without a lock. */
 	struct kfifo *event_fifo;
 
 	/* nickname */
 	u8 nodename[16];
 
 	/** spin locks */
+	/* Command and bus state: cur_cmd, the command queues, resp_*,
+	   dnld_sent and psstate. Taken outside tx_lock. */
 	spinlock_t driver_lock;
+	/* TX ring, TX counters and currenttxskb */
+	spinlock_t tx_lock;
+#ifdef LBS_LOCK_STATS
+	struct lbs_lock_stats driver_lock_stats;
+	struct lbs_lock_stats tx_lock_stats;
+#endif
 
 	/** Timers */
 	struct timer_list command_timer;
@@ -222,6 +361,24 @@ struct lbs_private {
 	struct list_head network_list;
 	struct list_head network_free_list;
 	struct bss_descriptor *networks;
+	/* Indexes over network_list, protected by priv->lock */
+	struct hlist_head bss_bssid_hash[LBS_BSS_HASH_SIZE];
+	struct hlist_head bss_ssid_hash[LBS_BSS_HASH_SIZE];
+	/* Indexed entries, least recently scanned first */
+	struct list_head network_age_list;
+	struct lbs_scan_lookup_stats scan_lookup;
+	struct lbs_scan_merge_stats scan_merge;
+	/* Bumped whenever an entry is added to or dropped from the table */
+	u32 scan_gen;
+
+	/* WEXT scan output cache and its cursor, see lbs_get_scan() */
+	char *scan_cache;
+	size_t scan_cache_len;
+	u32 scan_cache_gen;
+	u16 scan_cache_flags;
+	u8 scan_cache_done;
+	struct net_device *scan_cache_dev;
+	struct list_head *scan_cache_pos;
 
 	u16 beacon_period;
 	u8 beacon_enable;
@@ -291,6 +448,15 @@ struct lbs_private {
 	u8 rawNF[DEFAULT_DATA_AVG_FACTOR];
 	u16 nextSNRNF;
 	u16 numSNRNF;
+	/** Running sums over the rawSNR/rawNF window */
+	u16 sumSNR;
+	u16 sumNF;
+	u32 sqsumSNR;
+	u32 sqsumNF;
+	/** Extremes seen since the last (re)association */
+	u8 minSNR, maxSNR;
+	u8 minNF, maxNF;
+	u32 samplesSNRNF;
 
 	u8 radioon;
 	u32 preamble;
@@ -322,27 +488,47 @@ struct lbs_private {
 
 extern struct cmd_confirm_sleep confirm_sleep;
 
+/** Security class of a scanned BSS, worked out once when it is parsed */
+#define LBS_BSS_SEC_PRIVACY	0x01	/* capability privacy bit set */
+#define LBS_BSS_SEC_WPA		0x02	/* WPA vendor IE present */
+#define LBS_BSS_SEC_RSN		0x04	/* RSN (WPA2) IE present */
+
 /**
  *  @brief Structure used to store information for each beacon/probe response
+ *
+ *  Filled in place in its scan table slot by lbs_process_bss().  The fields
+ *  read by the lookup, compatibility and WEXT paths come first; the raw IEs
+ *  only needed when associating follow.
  */
 struct bss_descriptor {
 	u8 bssid[ETH_ALEN];
+	u8 ssid_len;
+
+	/* IW_MODE_AUTO, IW_MODE_ADHOC, IW_MODE_INFRA */
+	u8 mode;
 
 	u8 ssid[IW_ESSID_MAX_SIZE + 1];
-	u8 ssid_len;
 
+	u8 channel;
+	u8 rssi;
+	/* MHz, 0 if the channel isn't in the current region table */
+	u16 freq;
 	u16 capability;
-	u32 rssi;
-	u32 channel;
-	u16 beaconperiod;
-	u32 atimwindow;
 
-	/* IW_MODE_AUTO, IW_MODE_ADHOC, IW_MODE_INFRA */
-	u8 mode;
+	/* LBS_BSS_SEC_* */
+	u8 secclass;
+	u8 mesh;
+
+	/* bit n set if the BSS supports lbs_bg_rates[n] */
+	u16 rate_bitmap;
 
 	/* zero-terminated array of supported data rates */
+	u8 n_rates;
 	u8 rates[MAX_RATES + 1];
 
+	u16 beaconperiod;
+	u16 atimwindow;
+
 	unsigned long last_scanned;
 
 	union ieeetypes_phyparamset phyparamset;
@@ -350,14 +536,16 @@ struct bss_descriptor {
 
 	struct ieeetypes_countryinfofullset countryinfo;
 
+	u8 wpa_ie_len;
+	u8 rsn_ie_len;
 	u8 wpa_ie[MAX_WPA_IE_LEN];
-	size_t wpa_ie_len;
 	u8 rsn_ie[MAX_WPA_IE_LEN];
-	size_t rsn_ie_len;
-
-	u8 mesh;
 
 	struct list_head list;
+	/* Not touched by clear_bss_descriptor(), must stay after ->list */
+	struct hlist_node bssid_node;
+	struct hlist_node ssid_node;
+	struct list_head age_list;
 };
 
 /** Association request
@@ -404,4 +592,81 @@ struct assoc_request {
 	struct bss_descriptor bss;
 };
 
+#ifdef LBS_LOCK_STATS
+#define lbs_spin_lock_irqsave(lock, stats, flags)		\
+do {								\
+	int __busy = !spin_trylock_irqsave(lock, flags);	\
+	if (__busy)						\
+		spin_lock_irqsave(lock, flags);			\
+	(stats)->contended += __busy;				\
+	(stats)->taken = ktime_get();				\
+} while (0)
+
+#define lbs_spin_unlock_irqrestore(lock, stats, flags)		\
+do {								\
+	lbs_hist_add(&(stats)->hold, lbs_nsecs_since((stats)->taken)); \
+	spin_unlock_irqrestore(lock, flags);			\
+} while (0)
+
+#define lbs_spin_lock_irq(lock, stats)				\
+do {								\
+	int __busy = !spin_trylock_irq(lock);			\
+	if (__busy)						\
+		spin_lock_irq(lock);				\
+	(stats)->contended += __busy;				\
+	(stats)->taken = ktime_get();				\
+} while (0)
+
+#define lbs_spin_unlock_irq(lock, stats)			\
+do {								\
+	lbs_hist_add(&(stats)->hold, lbs_nsecs_since((stats)->taken)); \
+	spin_unlock_irq(lock);					\
+} while (0)
+
+#define lbs_spin_lock(lock, stats)				\
+do {								\
+	int __busy = !spin_trylock(lock);			\
+	if (__busy)						\
+		spin_lock(lock);				\
+	(stats)->contended += __busy;				\
+	(stats)->taken = ktime_get();				\
+} while (0)
+
+#define lbs_spin_unlock(lock, stats)				\
+do {								\
+	lbs_hist_add(&(stats)->hold, lbs_nsecs_since((stats)->taken)); \
+	spin_unlock(lock);					\
+} while (0)
+#else
+#define lbs_spin_lock_irqsave(lock, stats, flags)	spin_lock_irqsave(lock, flags)
+#define lbs_spin_unlock_irqrestore(lock, stats, flags)	spin_unlock_irqrestore(lock, flags)
+#define lbs_spin_lock_irq(lock, stats)			spin_lock_irq(lock)
+#define lbs_spin_unlock_irq(lock, stats)		spin_unlock_irq(lock)
+#define lbs_spin_lock(lock, stats)			spin_lock(lock)
+#define lbs_spin_unlock(lock, stats)			spin_unlock(lock)
+#endif
+
+/* The trace sequence number travels in the skb control buffer */
+#ifdef LBS_TX_TRACE
+static inline u32 lbs_tx_trace_seq(const struct sk_buff *skb)
+{
+	return *(const u32 *)skb->cb;
+}
+#else
+static inline u32 lbs_tx_trace_seq(const struct sk_buff *skb)
+{
+	return 0;
+}
+#endif
+
+static inline int lbs_tx_ring_full(struct lbs_private *priv)
+{
+	return priv->tx_ring_count >= priv->tx_ring_size;
+}
+
+static inline int lbs_tx_ring_ready(struct lbs_private *priv)
+{
+	return priv->tx_ring_count != 0;
+}
+
 #endif
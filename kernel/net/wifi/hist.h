@@ -0,0 +1,70 @@
+/**
+  * Power-of-two histograms used for the driver statistics
+  * exported through debugfs.
+  */
+#ifndef _LBS_HIST_H_
+#define _LBS_HIST_H_
+
+#include <linux/types.h>
+#include <linux/bitops.h>
+#include <linux/ktime.h>
+#include <linux/time.h>
+#include <asm/div64.h>
+
+#define LBS_HIST_BUCKETS	20
+
+/**
+ *  @brief Bucket 0 counts zero values, bucket n (n > 0) counts values
+ *  in [2^(n-1), 2^n). The last bucket also takes everything above.
+ */
+struct lbs_hist {
+	u32 bucket[LBS_HIST_BUCKETS];
+	u32 count;
+	u32 max;
+	u64 sum;
+};
+
+static inline void lbs_hist_add(struct lbs_hist *hist, u32 val)
+{
+	int i = fls(val);
+
+	if (i >= LBS_HIST_BUCKETS)
+		i = LBS_HIST_BUCKETS - 1;
+
+	hist->bucket[i]++;
+	hist->count++;
+	hist->sum += val;
+	if (val > hist->max)
+		hist->max = val;
+}
+
+/** Microseconds from start to end, both recorded by ktime_get() */
+static inline u32 lbs_usecs_between(ktime_t start, ktime_t end)
+{
+	u64 ns = ktime_to_ns(ktime_sub(end, start));
+
+	do_div(ns, NSEC_PER_USEC);
+	return ns;
+}
+
+/** Microseconds elapsed since start, as recorded by ktime_get() */
+static inline u32 lbs_usecs_since(ktime_t start)
+{
+	return lbs_usecs_between(start, ktime_get());
+}
+
+/** Nanoseconds elapsed since start, for the lock hold times */
+static inline u32 lbs_nsecs_since(ktime_t start)
+{
+	s64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	return ns > 0xffffffffLL ? 0xffffffff : ns;
+}
+
+/** Upper bound on what lbs_hist_print() writes for one histogram */
+#define LBS_HIST_PRINT_MAX	(128 + LBS_HIST_BUCKETS * 48)
+
+size_t lbs_hist_print(char *buf, size_t size, const char *name,
+		      const char *unit, struct lbs_hist *hist);
+
+#endif
@@ -6,6 +6,7 @@
 #define _LBS_HOSTCMD_H
 
 #include <linux/wireless.h>
+#include <linux/ktime.h>
 #include "11d.h"
 #include "types.h"
 
@@ -83,6 +84,16 @@ struct cmd_ctrl_node {
 	/* wait queue */
 	u16 cmdwaitqwoken;
 	wait_queue_head_t cmdwait_q;
+	/* bumped on every completion, for waiters on a merged command */
+	u32 completions;
+	/* merged callers still waiting; the last one recycles the node */
+	u16 waiters;
+	/* nobody waits for the response, recycled on completion */
+	u8 async;
+	/* scheduling class (LBS_CMD_PRIO_*) and timestamps for cmd_stats */
+	u8 prio;
+	ktime_t queued;
+	ktime_t submitted;
 };
 
 /* Generic structure to hold all key types. */
@@ -30,7 +30,18 @@
 #include <linux/firmware.h>
 #include <linux/netdevice.h>
 #include <linux/delay.h>
+#include <linux/hrtimer.h>
+#include <linux/completion.h>
+#include <linux/crc32.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/debugfs.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
 #include <linux/mmc/card.h>
+#include <linux/mmc/host.h>
 #include <linux/mmc/sdio_func.h>
 #include <linux/mmc/sdio_ids.h>
 #include <linux/platform_device.h>
@@ -44,6 +55,8 @@
 #include "defs.h"
 #include "dev.h"
 #include "if_sdio.h"
+#include "radiotap.h"
+#include "hist.h"
 
 extern int lbs_init_module(void);
 extern int lbs_exit_module(void);
@@ -56,6 +69,51 @@ module_param_named(helper_name, lbs_helper_name, charp, 0644);
 static char *lbs_fw_name = NULL;
 module_param_named(fw_name, lbs_fw_name, charp, 0644);
 
+/* IF_SDIO_STATUS polls done back to back before sleeping between them */
+static unsigned int if_sdio_spin_budget = 8;
+module_param_named(spin_budget, if_sdio_spin_budget, uint, 0644);
+
+/* Uploads and downloads done per host claim before the bus worker yields */
+static unsigned int if_sdio_rx_budget = 16;
+module_param_named(rx_budget, if_sdio_rx_budget, uint, 0644);
+
+static unsigned int if_sdio_tx_budget = 16;
+module_param_named(tx_budget, if_sdio_tx_budget, uint, 0644);
+
+/*
+ * TX aggregation packs several queued data frames, each padded to the
+ * block size, into one multi-block write. The firmware must be able to
+ * split such transfers and nothing reports whether it can, so it is off
+ * unless asked for.
+ */
+static int if_sdio_tx_aggr = 0;
+module_param_named(tx_aggr, if_sdio_tx_aggr, int, 0444);
+
+static unsigned int if_sdio_tx_aggr_max = 8192;
+module_param_named(tx_aggr_max, if_sdio_tx_aggr_max, uint, 0444);
+
+/* usecs a frame may wait for others; rounded up to a jiffy */
+static unsigned int if_sdio_tx_aggr_timeout = 1000;
+module_param_named(tx_aggr_timeout, if_sdio_tx_aggr_timeout, uint, 0644);
+
+/*
+ * Fast firmware download: large blocks for the main image, short
+ * boot-wait polls and the main image requested while the helper loads.
+ */
+static int if_sdio_fast_fw = 0;
+module_param_named(fast_fw, if_sdio_fast_fw, int, 0644);
+
+/*
+ * The bus worker thread: scheduling priority (0 normal, 1-99 SCHED_FIFO,
+ * negative for a nice level) and the CPU it is bound to (-1 for any).
+ * Applied when the card is probed.
+ */
+static int if_sdio_worker_prio = 0;
+module_param_named(worker_prio, if_sdio_worker_prio, int, 0644);
+
+static int if_sdio_worker_cpu = -1;
+module_param_named(worker_cpu, if_sdio_worker_cpu, int, 0644);
+
 static const struct sdio_device_id if_sdio_ids[] = {
 	{ SDIO_DEVICE(SDIO_VENDOR_ID_MARVELL, SDIO_DEVICE_ID_MARVELL_LIBERTAS) },
 	{ /* end: all zeroes */						},
@@ -161,12 +219,46 @@ static struct if_sdio_model if_sdio_models[] = {
 	},
 };
 
+/* Packets kept preallocated for if_sdio_host_to_card() */
+#define IF_SDIO_POOL_PACKETS	8
+
 struct if_sdio_packet {
-	struct if_sdio_packet	*next;
+	struct list_head	list;
 	u16			nb;
+	u8			pooled;
 	u8			buffer[0] __attribute__((aligned(4)));
 };
 
+/* Callers of if_sdio_wait_status(), each with its own histogram */
+enum if_sdio_wait_site {
+	IF_SDIO_WAIT_RX,
+	IF_SDIO_WAIT_TX,
+	IF_SDIO_WAIT_HELPER,
+	IF_SDIO_WAIT_FW,
+	IF_SDIO_WAIT_NR,
+};
+
+static const char *if_sdio_wait_names[IF_SDIO_WAIT_NR] = {
+	"wait_rx", "wait_tx", "wait_helper", "wait_fw",
+};
+
+/* Jobs run by the bus worker thread, see if_sdio_service() */
+enum if_sdio_job {
+	IF_SDIO_JOB_RX,
+	IF_SDIO_JOB_TX,
+	IF_SDIO_JOB_NR,
+};
+
+static const char *if_sdio_job_names[IF_SDIO_JOB_NR] = {
+	"rx", "tx",
+};
+
+#define IF_SDIO_WAIT_MIN_US	10
+#define IF_SDIO_WAIT_MAX_US	1000
+
+/* Largest main image chunk staged per write in fast download mode */
+#define IF_SDIO_FW_CHUNK_MAX	16384U
+
 struct if_sdio_card {
 	struct sdio_func	*func;
 	struct lbs_private	*priv;
@@ -177,13 +269,191 @@ struct if_sdio_card {
 	const char		*helper;
 	const char		*firmware;
 
-	u8			buffer[65536];
-
+	/*
+	 * Download queues, protected by lock. Commands always go out
+	 * before data; data is either copied (data_packets) or sent
+	 * from the skb (data_skbs).
+	 */
 	spinlock_t		lock;
-	struct if_sdio_packet	*packets;
-	struct work_struct	packet_worker;
+	struct list_head	cmd_packets;
+	struct list_head	data_packets;
+	struct sk_buff_head	data_skbs;
+	unsigned int		cmd_depth;
+	unsigned int		cmd_hiwat;
+	unsigned int		data_depth;
+	unsigned int		data_hiwat;
+
+	/* free list of preallocated packets, protected by lock */
+	struct list_head	pool;
+	unsigned int		pool_bufsize;
+	unsigned int		pool_count;
+	unsigned int		pool_free;
+	unsigned int		pool_low;
+	u32			pool_hits;
+	u32			pool_misses;
+	u32			alloc_failures;
+
+	/* TX aggregation, only set up when if_sdio_tx_aggr is on */
+	u8			*aggr_buf;
+	unsigned int		aggr_bufsize;
+	unsigned int		aggr_bytes;	/* padded bytes in data_skbs */
+	int			aggr_flush;
+	struct timer_list	aggr_timer;
+	struct lbs_hist		aggr_frames;
+	struct lbs_hist		aggr_size;
+
+	/*
+	 * Bus worker thread, see if_sdio_worker(). Once the firmware is
+	 * up every SDIO transaction except the interrupt status read
+	 * runs on it. Pending jobs are protected by lock.
+	 */
+	struct task_struct	*worker;
+	unsigned long		worker_jobs;	/* bit per if_sdio_job */
+	ktime_t			job_queued[IF_SDIO_JOB_NR];
+	struct lbs_hist		job_wait[IF_SDIO_JOB_NR];
+	struct lbs_hist		service_time;
+
+	/* host claims taken by if_sdio_service() */
+	u32			claims;
+	struct lbs_hist		claim_txns;	/* uploads + downloads */
+	u32			status_reads;	/* of IF_SDIO_H_INT_STATUS */
+	u32			tx_budget_hits;
+
+	/* polled RX, see if_sdio_service() */
+	struct sk_buff_head	rx_batch;
+	u8			*rx_fallback;	/* drains uploads if skbs run out */
+	unsigned int		rx_fallback_size;
+	u32			rx_fallback_reads;
+	int			rx_scheduled;
+	ktime_t			rx_irq_time;	/* first interrupt not yet polled */
+	struct lbs_hist		rx_latency;
+	struct lbs_hist		rx_per_poll;
+	u32			rx_budget_hits;
+
+	/* time spent waiting for IF_SDIO_STATUS, per call site */
+	struct lbs_hist		wait_hist[IF_SDIO_WAIT_NR];
+	u32			wait_timeouts;
+
+	/* duration of the last firmware download, by phase */
+	struct {
+		u32		helper_us;
+		u32		helper_boot_us;
+		u32		image_us;
+		u32		boot_us;
+		u32		total_us;
+		int		cached;		/* both images from the cache */
+	}			fw_time;
+
+	struct dentry		*debugfs_stats;
 };
 
+/********************************************************************/
+/* Packet pool                                                      */
+/********************************************************************/
+
+static int if_sdio_alloc_pool(struct if_sdio_card *card)
+{
+	struct if_sdio_packet *packet;
+	int i;
+
+	/*
+	 * Size the buffers for the largest transfer the core hands us,
+	 * padded the way if_sdio_host_to_card() will pad it.
+	 */
+	card->pool_bufsize = sdio_align_size(card->func, LBS_UPLD_SIZE + 4);
+
+	for (i = 0; i < IF_SDIO_POOL_PACKETS; i++) {
+		packet = kmalloc(sizeof(struct if_sdio_packet) +
+				card->pool_bufsize, GFP_KERNEL);
+		if (!packet)
+			return -ENOMEM;
+
+		packet->pooled = 1;
+		list_add(&packet->list, &card->pool);
+		card->pool_count++;
+	}
+
+	card->pool_free = card->pool_low = card->pool_count;
+
+	/*
+	 * An upload must always be read, or a command response or event
+	 * behind it never arrives. Without an skb it goes here.
+	 */
+	card->rx_fallback_size = sdio_align_size(card->func, 0xffff);
+	card->rx_fallback = kmalloc(card->rx_fallback_size, GFP_KERNEL);
+	if (!card->rx_fallback)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static void if_sdio_free_packets(struct list_head *list)
+{
+	struct if_sdio_packet *packet, *tmp;
+
+	list_for_each_entry_safe(packet, tmp, list, list) {
+		list_del(&packet->list);
+		kfree(packet);
+	}
+}
+
+static void if_sdio_free_pool(struct if_sdio_card *card)
+{
+	if_sdio_free_packets(&card->pool);
+	card->pool_free = 0;
+	kfree(card->rx_fallback);
+	card->rx_fallback = NULL;
+}
+
+static struct if_sdio_packet *if_sdio_get_packet(struct if_sdio_card *card,
+		u16 size)
+{
+	struct if_sdio_packet *packet = NULL;
+	unsigned long flags;
+
+	spin_lock_irqsave(&card->lock, flags);
+	if (!list_empty(&card->pool) && size <= card->pool_bufsize) {
+		packet = list_first_entry(&card->pool,
+				struct if_sdio_packet, list);
+		list_del(&packet->list);
+		if (--card->pool_free < card->pool_low)
+			card->pool_low = card->pool_free;
+		card->pool_hits++;
+	} else
+		card->pool_misses++;
+	spin_unlock_irqrestore(&card->lock, flags);
+
+	if (packet)
+		return packet;
+
+	packet = kmalloc(sizeof(struct if_sdio_packet) + size, GFP_ATOMIC);
+	if (!packet) {
+		spin_lock_irqsave(&card->lock, flags);
+		card->alloc_failures++;
+		spin_unlock_irqrestore(&card->lock, flags);
+		return NULL;
+	}
+	packet->pooled = 0;
+
+	return packet;
+}
+
+static void if_sdio_put_packet(struct if_sdio_card *card,
+		struct if_sdio_packet *packet)
+{
+	unsigned long flags;
+
+	if (!packet->pooled) {
+		kfree(packet);
+		return;
+	}
+
+	spin_lock_irqsave(&card->lock, flags);
+	list_add(&packet->list, &card->pool);
+	card->pool_free++;
+	spin_unlock_irqrestore(&card->lock, flags);
+}
+
 /********************************************************************/
 /* I/O                                                              */
 /********************************************************************/
@@ -211,6 +481,67 @@ static u16 if_sdio_read_scratch(struct if_sdio_card *card, int *err)
 	return scratch;
 }
 
+/*
+ * usleep_range() does not exist on this kernel and msleep() rounds up
+ * to whole jiffies, so sleep on an hrtimer like nanosleep does.
+ */
+static void if_sdio_usleep(unsigned long usecs)
+{
+	struct hrtimer_sleeper t;
+
+	hrtimer_init(&t.timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	hrtimer_init_sleeper(&t, current);
+
+	set_current_state(TASK_UNINTERRUPTIBLE);
+	hrtimer_start(&t.timer, ktime_set(0, usecs * NSEC_PER_USEC),
+		HRTIMER_MODE_REL);
+	if (t.task)
+		schedule();
+
+	hrtimer_cancel(&t.timer);
+	__set_current_state(TASK_RUNNING);
+}
+
+/*
+ * Waits until all bits of mask are set in IF_SDIO_STATUS. The register
+ * is first polled spin_budget times back to back, then with sleeps
+ * doubling from IF_SDIO_WAIT_MIN_US up to IF_SDIO_WAIT_MAX_US, for at
+ * most a second. Must be called with the host claimed.
+ */
+static int if_sdio_wait_status(struct if_sdio_card *card, u8 mask,
+		enum if_sdio_wait_site site)
+{
+	ktime_t start = ktime_get();
+	unsigned long timeout = jiffies + HZ;
+	unsigned long delay = IF_SDIO_WAIT_MIN_US;
+	unsigned int polls = 0;
+	u8 status;
+	int ret;
+
+	while (1) {
+		status = sdio_readb(card->func, IF_SDIO_STATUS, &ret);
+		if (ret)
+			break;
+		if ((status & mask) == mask)
+			break;
+		if (time_after(jiffies, timeout)) {
+			card->wait_timeouts++;
+			ret = -ETIMEDOUT;
+			break;
+		}
+		if (++polls <= if_sdio_spin_budget) {
+			cpu_relax();
+			continue;
+		}
+		if_sdio_usleep(delay);
+		delay = min(delay * 2, (unsigned long)IF_SDIO_WAIT_MAX_US);
+	}
+
+	lbs_hist_add(&card->wait_hist[site], lbs_usecs_since(start));
+
+	return ret;
+}
+
 static int if_sdio_handle_cmd(struct if_sdio_card *card,
 		u8 *buffer, unsigned size)
 {
@@ -228,7 +559,8 @@ static int if_sdio_handle_cmd(struct if_sdio_card *card,
 		goto out;
 	}
 
-	spin_lock_irqsave(&priv->driver_lock, flags);
+	lbs_spin_lock_irqsave(&priv->driver_lock, &priv->driver_lock_stats,
+			      flags);
 
 	i = (priv->resp_idx == 0) ? 1 : 0;
 	BUG_ON(priv->resp_len[i]);
@@ -236,7 +568,8 @@ static int if_sdio_handle_cmd(struct if_sdio_card *card,
 	memcpy(priv->resp_buf[i], buffer, size);
 	lbs_notify_command_response(priv, i);
 
-	spin_unlock_irqrestore(&card->priv->driver_lock, flags);
+	lbs_spin_unlock_irqrestore(&priv->driver_lock,
+				   &priv->driver_lock_stats, flags);
 
 	ret = 0;
 
@@ -245,12 +578,15 @@ out:
 	return ret;
 }
 
+/*
+ * The upload was read straight into skb, which still starts with the
+ * SDIO header. On success the skb is queued for delivery at the end of
+ * the RX poll.
+ */
 static int if_sdio_handle_data(struct if_sdio_card *card,
-		u8 *buffer, unsigned size)
+		struct sk_buff *skb, unsigned size)
 {
 	int ret;
-	struct sk_buff *skb;
-	char *data;
 
 	lbs_deb_enter(LBS_DEB_SDIO);
 
@@ -261,19 +597,20 @@ static int if_sdio_handle_data(struct if_sdio_card *card,
 		goto out;
 	}
 
-	skb = dev_alloc_skb(MRVDRV_ETH_RX_PACKET_BUFFER_SIZE + NET_IP_ALIGN);
-	if (!skb) {
-		ret = -ENOMEM;
-		goto out;
-	}
+	skb_put(skb, size + 4);
+	skb_pull(skb, 4);
 
-	skb_reserve(skb, NET_IP_ALIGN);
-
-	data = skb_put(skb, size);
-
-	memcpy(data, buffer, size);
+	/*
+	 * The upload was read into a word aligned buffer for the DMA;
+	 * shift the frame so the IP header ends up aligned.
+	 */
+	if (NET_IP_ALIGN) {
+		skb_push(skb, NET_IP_ALIGN);
+		memmove(skb->data, skb->data + NET_IP_ALIGN, size);
+		skb_trim(skb, size);
+	}
 
-	lbs_process_rxed_packet(card->priv, skb);
+	__skb_queue_tail(&card->rx_batch, skb);
 
 	ret = 0;
 
@@ -320,9 +657,10 @@ out:
 static int if_sdio_card_to_host(struct if_sdio_card *card)
 {
 	int ret;
-	u8 status;
 	u16 size, type, chunk;
-	unsigned long timeout;
+	struct sk_buff *skb = NULL;
+	unsigned int headroom;
+	u8 *buffer;
 
 	lbs_deb_enter(LBS_DEB_SDIO);
 
@@ -337,19 +675,9 @@ static int if_sdio_card_to_host(struct if_sdio_card *card)
 		goto out;
 	}
 
-	timeout = jiffies + HZ;
-	while (1) {
-		status = sdio_readb(card->func, IF_SDIO_STATUS, &ret);
-		if (ret)
-			goto out;
-		if (status & IF_SDIO_IO_RDY)
-			break;
-		if (time_after(jiffies, timeout)) {
-			ret = -ETIMEDOUT;
-			goto out;
-		}
-		mdelay(1);
-	}
+	ret = if_sdio_wait_status(card, IF_SDIO_IO_RDY, IF_SDIO_WAIT_RX);
+	if (ret)
+		goto out;
 
 	/*
 	 * The transfer must be in one transaction or the firmware
@@ -358,12 +686,34 @@ static int if_sdio_card_to_host(struct if_sdio_card *card)
 	 */
 	chunk = sdio_align_size(card->func, size);
 
-	ret = sdio_readsb(card->func, card->buffer, card->ioport, chunk);
+	/*
+	 * Read straight into an skb of the right size, so data packets
+	 * can be passed on without another allocation. The headroom is
+	 * kept a multiple of 4 so the transfer buffer stays word aligned;
+	 * it leaves NET_IP_ALIGN for if_sdio_handle_data() and, in monitor
+	 * mode, room for the radiotap header on top.
+	 */
+	headroom = NET_IP_ALIGN;
+	if (card->priv->monitormode)
+		headroom += LBS_RX_RTAP_HEADROOM;
+	headroom = ALIGN(headroom, 4);
+
+	skb = __dev_alloc_skb(chunk + headroom, GFP_KERNEL);
+	if (skb) {
+		skb_reserve(skb, headroom);
+		buffer = skb->data;
+	} else {
+		/* commands and events still work, data is dropped below */
+		card->rx_fallback_reads++;
+		buffer = card->rx_fallback;
+	}
+
+	ret = sdio_readsb(card->func, buffer, card->ioport, chunk);
 	if (ret)
 		goto out;
 
-	chunk = card->buffer[0] | (card->buffer[1] << 8);
-	type = card->buffer[2] | (card->buffer[3] << 8);
+	chunk = buffer[0] | (buffer[1] << 8);
+	type = buffer[2] | (buffer[3] << 8);
 
 	lbs_deb_sdio("packet of type %d and size %d bytes\n",
 		(int)type, (int)chunk);
@@ -382,17 +732,25 @@ static int if_sdio_card_to_host(struct if_sdio_card *card)
 
 	switch (type) {
 	case MVMS_CMD:
-		ret = if_sdio_handle_cmd(card, card->buffer + 4, chunk - 4);
+		ret = if_sdio_handle_cmd(card, buffer + 4, chunk - 4);
 		if (ret)
 			goto out;
 		break;
 	case MVMS_DAT:
-		ret = if_sdio_handle_data(card, card->buffer + 4, chunk - 4);
+		if (!skb) {
+			if (card->priv->monitormode)
+				card->priv->rtap_stats.rx_dropped++;
+			card->priv->stats.rx_dropped++;
+			ret = -ENOMEM;
+			goto out;
+		}
+		ret = if_sdio_handle_data(card, skb, chunk - 4);
 		if (ret)
 			goto out;
+		skb = NULL;
 		break;
 	case MVMS_EVENT:
-		ret = if_sdio_handle_event(card, card->buffer + 4, chunk - 4);
+		ret = if_sdio_handle_event(card, buffer + 4, chunk - 4);
 		if (ret)
 			goto out;
 		break;
@@ -404,93 +762,703 @@ static int if_sdio_card_to_host(struct if_sdio_card *card)
 	}
 
 out:
+	if (skb)
+		kfree_skb(skb);
+
 	if (ret)
 		lbs_pr_err("problem fetching packet from firmware\n");
 
-	lbs_deb_leave_args(LBS_DEB_SDIO, "ret %d", ret);
+	lbs_deb_leave_args(LBS_DEB_SDIO, "ret %d", ret);
+
+	return ret;
+}
+
+/********************************************************************/
+/* Bus worker                                                       */
+/********************************************************************/
+
+/*
+ * Asks the bus worker to run a job. A job asked for again before it
+ * ran is only run once, and its wait is timed from the first request.
+ */
+static void if_sdio_kick(struct if_sdio_card *card, int job)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&card->lock, flags);
+	if (!(card->worker_jobs & (1 << job))) {
+		card->worker_jobs |= 1 << job;
+		card->job_queued[job] = ktime_get();
+	}
+	if (card->worker)
+		wake_up_process(card->worker);
+	spin_unlock_irqrestore(&card->lock, flags);
+}
+
+/********************************************************************/
+/* Polled RX                                                        */
+/********************************************************************/
+
+/*
+ * Reads one upload and the interrupt status behind it, handling a
+ * DNLD acknowledgement found there. *pending is set if the card has
+ * another upload ready. Must be called with the host claimed.
+ */
+static int if_sdio_rx_one(struct if_sdio_card *card, int *pending)
+{
+	u8 cause;
+	int ret;
+
+	*pending = 0;
+
+	ret = if_sdio_card_to_host(card);
+	if (ret)
+		return ret;
+
+	cause = sdio_readb(card->func, IF_SDIO_H_INT_STATUS, &ret);
+	card->status_reads++;
+	if (ret || !cause)
+		return ret;
+
+	sdio_writeb(card->func, ~cause, IF_SDIO_H_INT_STATUS, &ret);
+	if (ret)
+		return ret;
+
+	if (cause & IF_SDIO_H_INT_DNLD)
+		lbs_host_to_card_done(card->priv);
+
+	*pending = cause & IF_SDIO_H_INT_UPLD;
+
+	return 0;
+}
+
+/********************************************************************/
+/* TX aggregation                                                   */
+/********************************************************************/
+
+static unsigned int if_sdio_aggr_len(struct if_sdio_card *card,
+		unsigned int len)
+{
+	return roundup(len, card->func->cur_blksize);
+}
+
+/*
+ * Flushes frames held too long. While they are collected dnld_sent is
+ * DNLD_DATA_COLLECTING, which keeps commands off the bus, so the
+ * aggregate can take the bus over. If something else owns it (e.g.
+ * after a TX timeout reset it), the flush is retried later.
+ */
+static void if_sdio_aggr_timeout(unsigned long data)
+{
+	struct if_sdio_card *card = (struct if_sdio_card *)data;
+	struct lbs_private *priv = card->priv;
+	unsigned long flags;
+	int flush = 0, retry = 0;
+
+	spin_lock_irqsave(&priv->driver_lock, flags);
+	spin_lock(&card->lock);
+	if (!skb_queue_empty(&card->data_skbs) && !card->aggr_flush) {
+		if (priv->dnld_sent == DNLD_DATA_COLLECTING) {
+			priv->dnld_sent = DNLD_DATA_SENT;
+			card->aggr_flush = 1;
+			flush = 1;
+		} else
+			retry = 1;
+	}
+	spin_unlock(&card->lock);
+	spin_unlock_irqrestore(&priv->driver_lock, flags);
+
+	if (flush)
+		if_sdio_kick(card, IF_SDIO_JOB_TX);
+	else if (retry)
+		mod_timer(&card->aggr_timer,
+			jiffies + usecs_to_jiffies(if_sdio_tx_aggr_timeout));
+}
+
+static int if_sdio_init_aggr(struct if_sdio_card *card)
+{
+	struct mmc_host *host = card->func->card->host;
+	unsigned int blksz = card->func->cur_blksize;
+	unsigned int size;
+
+	if (!if_sdio_tx_aggr)
+		return 0;
+
+	if (!card->func->card->cccr.multi_block) {
+		lbs_pr_info("no multi-block support, TX aggregation disabled\n");
+		return 0;
+	}
+
+	/* The aggregate must go out as a single CMD53 */
+	size = min(if_sdio_tx_aggr_max, host->max_req_size);
+	size = min(size, host->max_blk_count * blksz);
+	size -= size % blksz;
+
+	if (size < 2 * if_sdio_aggr_len(card, LBS_UPLD_SIZE + 4)) {
+		lbs_pr_info("TX aggregate size %u too small, disabled\n", size);
+		return 0;
+	}
+
+	card->aggr_buf = kmalloc(size, GFP_KERNEL);
+	if (!card->aggr_buf)
+		return -ENOMEM;
+	card->aggr_bufsize = size;
+
+	lbs_deb_sdio("TX aggregation up to %u bytes\n", size);
+
+	return 0;
+}
+
+static void if_sdio_free_aggr(struct if_sdio_card *card)
+{
+	del_timer_sync(&card->aggr_timer);
+	kfree(card->aggr_buf);
+	card->aggr_buf = NULL;
+}
+
+/*
+ * Moves the frames of the next aggregate from data_skbs to frames.
+ * Called with card->lock held.
+ */
+static void if_sdio_collect_aggr(struct if_sdio_card *card,
+		struct sk_buff_head *frames)
+{
+	struct sk_buff *skb;
+	unsigned int size = 0, len;
+
+	while ((skb = skb_peek(&card->data_skbs))) {
+		len = if_sdio_aggr_len(card, skb->len);
+		if (size + len > card->aggr_bufsize)
+			break;
+
+		__skb_unlink(skb, &card->data_skbs);
+		__skb_queue_tail(frames, skb);
+		card->aggr_bytes -= len;
+		card->data_depth--;
+		size += len;
+	}
+
+	/*
+	 * One aggregate per claim of dnld_sent. Everything collected
+	 * fits, see if_sdio_host_to_card_skb(), so nothing is left
+	 * behind unless the core queued more after a reset.
+	 */
+	card->aggr_flush = 0;
+}
+
+/*
+ * Packs the collected frames into the aggregation buffer and writes
+ * them with one transfer. The SDIO header of each sub-frame gives its
+ * padded length, so the firmware can find the next one. Must be called
+ * with the host claimed.
+ */
+static int if_sdio_write_aggr(struct if_sdio_card *card,
+		struct sk_buff_head *frames)
+{
+	struct sk_buff *skb;
+	unsigned int size = 0, len, nr = 0;
+
+	while ((skb = __skb_dequeue(frames))) {
+		len = if_sdio_aggr_len(card, skb->len);
+
+		memcpy(card->aggr_buf + size, skb->data, skb->len);
+		memset(card->aggr_buf + size + skb->len, 0, len - skb->len);
+		card->aggr_buf[size] = len & 0xff;
+		card->aggr_buf[size + 1] = (len >> 8) & 0xff;
+
+		size += len;
+		nr++;
+		dev_kfree_skb_any(skb);
+	}
+
+	lbs_hist_add(&card->aggr_frames, nr);
+	lbs_hist_add(&card->aggr_size, size);
+
+	return sdio_writesb(card->func, card->ioport, card->aggr_buf, size);
+}
+
+/*
+ * Writes the next queued command, data packet or aggregate. Returns 0
+ * if nothing was due, 1 once something went out or was dropped after
+ * an error. Must be called with the host claimed.
+ */
+static int if_sdio_tx_one(struct if_sdio_card *card)
+{
+	struct if_sdio_packet *packet = NULL;
+	struct sk_buff *skb = NULL;
+	struct sk_buff_head frames;
+	u32 first = 0, last = 0;
+	int ret;
+	unsigned long flags;
+
+	skb_queue_head_init(&frames);
+
+	/* Commands take priority over data */
+	spin_lock_irqsave(&card->lock, flags);
+	if (!list_empty(&card->cmd_packets)) {
+		packet = list_first_entry(&card->cmd_packets,
+				struct if_sdio_packet, list);
+		card->cmd_depth--;
+	} else if (!list_empty(&card->data_packets)) {
+		packet = list_first_entry(&card->data_packets,
+				struct if_sdio_packet, list);
+		card->data_depth--;
+	} else if (card->aggr_buf) {
+		/* Hold the frames back until the aggregate is due */
+		if (card->aggr_flush)
+			if_sdio_collect_aggr(card, &frames);
+	} else if ((skb = __skb_dequeue(&card->data_skbs)))
+		card->data_depth--;
+	if (packet)
+		list_del(&packet->list);
+	spin_unlock_irqrestore(&card->lock, flags);
+
+	/* A lone frame is still sent straight from its skb */
+	if (skb_queue_len(&frames) == 1) {
+		skb = __skb_dequeue(&frames);
+		lbs_hist_add(&card->aggr_frames, 1);
+		lbs_hist_add(&card->aggr_size,
+			sdio_align_size(card->func, skb->len));
+	}
+
+	if (!packet && !skb && skb_queue_empty(&frames))
+		return 0;
+
+	/* Data frames carry their TX trace sequence numbers */
+	if (skb) {
+		first = last = lbs_tx_trace_seq(skb);
+	} else if (!packet) {
+		first = lbs_tx_trace_seq(skb_peek(&frames));
+		last = lbs_tx_trace_seq(skb_peek_tail(&frames));
+	}
+	if (!packet)
+		lbs_tx_trace_stamp(card->priv, first, last,
+				LBS_TX_STAGE_WORKER);
+
+	ret = if_sdio_wait_status(card, IF_SDIO_IO_RDY, IF_SDIO_WAIT_TX);
+	if (ret)
+		goto out;
+
+	if (!packet)
+		lbs_tx_trace_stamp(card->priv, first, last,
+				LBS_TX_STAGE_IO_RDY);
+
+	/* The tailroom was checked in if_sdio_host_to_card_skb() */
+	if (packet)
+		ret = sdio_writesb(card->func, card->ioport,
+				packet->buffer, packet->nb);
+	else if (skb)
+		ret = sdio_writesb(card->func, card->ioport, skb->data,
+				sdio_align_size(card->func, skb->len));
+	else
+		ret = if_sdio_write_aggr(card, &frames);
+	if (ret)
+		goto out;
+
+	/* The host is still claimed, so the DNLD interrupt can't be
+	   handled first */
+	if (!packet)
+		lbs_tx_trace_stamp(card->priv, first, last,
+				LBS_TX_STAGE_WRITTEN);
+out:
+	if (packet)
+		if_sdio_put_packet(card, packet);
+	else if (skb)
+		dev_kfree_skb_any(skb);
+	skb_queue_purge(&frames);
+
+	return 1;
+}
+
+/********************************************************************/
+/* Bus service                                                      */
+/********************************************************************/
+
+/*
+ * Services the card under a single host claim, alternating between
+ * uploads, while the card reports them, and queued downloads until
+ * neither has work left or its budget runs out. Leftover work is
+ * kicked again so the host is released in between. The uploaded data
+ * packets are delivered in one batch once the host is released.
+ */
+static void if_sdio_service(struct if_sdio_card *card, unsigned long jobs)
+{
+	struct sk_buff *skb;
+	ktime_t irq_time = ktime_set(0, 0);
+	unsigned int rx_done = 0, tx_done = 0, rx_budget, tx_budget;
+	unsigned long flags;
+	int rx_pending = 0, tx_pending = 1;
+	int progress;
+	u32 latency;
+
+	lbs_deb_enter(LBS_DEB_SDIO);
+
+	if (jobs & (1 << IF_SDIO_JOB_RX)) {
+		spin_lock_irqsave(&card->lock, flags);
+		irq_time = card->rx_irq_time;
+		card->rx_scheduled = 0;
+		spin_unlock_irqrestore(&card->lock, flags);
+		rx_pending = 1;
+	}
+
+	rx_budget = max(if_sdio_rx_budget, 1U);
+	tx_budget = max(if_sdio_tx_budget, 1U);
+
+	sdio_claim_host(card->func);
+
+	do {
+		progress = 0;
+
+		if (rx_pending && rx_done < rx_budget) {
+			if (if_sdio_rx_one(card, &rx_pending))
+				rx_pending = 0;
+			else
+				rx_done++;
+			progress = 1;
+		}
+
+		if (tx_pending && tx_done < tx_budget) {
+			tx_pending = if_sdio_tx_one(card);
+			tx_done += tx_pending;
+			progress |= tx_pending;
+		}
+	} while (progress);
+
+	sdio_release_host(card->func);
+
+	card->claims++;
+	lbs_hist_add(&card->claim_txns, rx_done + tx_done);
+
+	if (jobs & (1 << IF_SDIO_JOB_RX)) {
+		/*
+		 * With bottom halves off netif_rx() only queues the
+		 * packets, and the stack processes the whole batch on
+		 * local_bh_enable().
+		 */
+		latency = lbs_usecs_since(irq_time);
+
+		local_bh_disable();
+		while ((skb = __skb_dequeue(&card->rx_batch))) {
+			lbs_hist_add(&card->rx_latency, latency);
+			lbs_process_rxed_packet(card->priv, skb);
+		}
+		local_bh_enable();
+
+		lbs_hist_add(&card->rx_per_poll, rx_done);
+	}
+
+	if (rx_pending) {
+		card->rx_budget_hits++;
+
+		spin_lock_irqsave(&card->lock, flags);
+		if (!card->rx_scheduled) {
+			card->rx_scheduled = 1;
+			card->rx_irq_time = irq_time;
+		}
+		spin_unlock_irqrestore(&card->lock, flags);
+
+		if_sdio_kick(card, IF_SDIO_JOB_RX);
+	}
+
+	if (tx_pending && tx_done == tx_budget) {
+		card->tx_budget_hits++;
+		if_sdio_kick(card, IF_SDIO_JOB_TX);
+	}
+
+	lbs_deb_leave(LBS_DEB_SDIO);
+}
+
+/*
+ * Runs the jobs asked for with if_sdio_kick(), timing how long each
+ * waited for the thread and how long servicing them then took.
+ */
+static int if_sdio_worker(void *data)
+{
+	struct if_sdio_card *card = data;
+	ktime_t queued[IF_SDIO_JOB_NR], start;
+	unsigned long jobs, flags;
+	int i;
+
+	lbs_deb_enter(LBS_DEB_SDIO);
+
+	for (;;) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (kthread_should_stop())
+			break;
+
+		spin_lock_irqsave(&card->lock, flags);
+		jobs = card->worker_jobs;
+		card->worker_jobs = 0;
+		memcpy(queued, card->job_queued, sizeof(queued));
+		spin_unlock_irqrestore(&card->lock, flags);
+
+		if (!jobs) {
+			schedule();
+			continue;
+		}
+
+		__set_current_state(TASK_RUNNING);
+
+		start = ktime_get();
+		for (i = 0; i < IF_SDIO_JOB_NR; i++)
+			if (jobs & (1 << i))
+				lbs_hist_add(&card->job_wait[i],
+					lbs_usecs_between(queued[i], start));
+
+		if_sdio_service(card, jobs);
+
+		lbs_hist_add(&card->service_time, lbs_usecs_since(start));
+	}
+
+	__set_current_state(TASK_RUNNING);
+
+	lbs_deb_leave(LBS_DEB_SDIO);
+	return 0;
+}
+
+static int if_sdio_start_worker(struct if_sdio_card *card)
+{
+	struct task_struct *task;
+	struct sched_param param;
+	unsigned long flags;
+	int cpu = if_sdio_worker_cpu;
+
+	task = kthread_create(if_sdio_worker, card, "lbs_sdio");
+	if (IS_ERR(task)) {
+		lbs_pr_err("could not start the bus worker\n");
+		return PTR_ERR(task);
+	}
+
+	if (cpu >= 0) {
+		if (cpu < NR_CPUS && cpu_online(cpu))
+			kthread_bind(task, cpu);
+		else
+			lbs_pr_info("worker_cpu %d is not online, "
+				"not binding\n", cpu);
+	}
+
+	if (if_sdio_worker_prio > 0) {
+		param.sched_priority = min(if_sdio_worker_prio,
+			MAX_USER_RT_PRIO - 1);
+		if (sched_setscheduler(task, SCHED_FIFO, &param))
+			lbs_pr_info("could not make the bus worker "
+				"SCHED_FIFO\n");
+	} else if (if_sdio_worker_prio < 0)
+		set_user_nice(task, max(if_sdio_worker_prio, -20));
+
+	spin_lock_irqsave(&card->lock, flags);
+	card->worker = task;
+	spin_unlock_irqrestore(&card->lock, flags);
+
+	wake_up_process(task);
+
+	return 0;
+}
+
+/*
+ * Jobs asked for after this are dropped, so the card must be quiet or
+ * about to go away.
+ */
+static void if_sdio_stop_worker(struct if_sdio_card *card)
+{
+	struct task_struct *task;
+	unsigned long flags;
+
+	spin_lock_irqsave(&card->lock, flags);
+	task = card->worker;
+	card->worker = NULL;
+	spin_unlock_irqrestore(&card->lock, flags);
+
+	if (task)
+		kthread_stop(task);
+}
+
+/********************************************************************/
+/* Firmware                                                         */
+/********************************************************************/
+
+/*
+ * Helper and main images are kept once they have booted a card, so a
+ * re-probe after a reset or resume doesn't go back to userspace. The
+ * cache lives as long as the module and is keyed by model and image
+ * name; a CRC taken when the image is stored is checked on every hit.
+ * An image handed out by if_sdio_fw_cache_get() stays valid until it is
+ * given back with if_sdio_fw_cache_release(); one dropped meanwhile is
+ * only marked stale and freed by its last user.
+ */
+struct if_sdio_fw_cache {
+	int			model;
+	const char		*name;
+	const struct firmware	*fw;
+	u32			crc;
+	int			users;
+	int			stale;
+};
+
+static struct if_sdio_fw_cache if_sdio_fw_cache[2 * ARRAY_SIZE(if_sdio_models)];
+static DEFINE_MUTEX(if_sdio_fw_cache_lock);
+
+/* protected by if_sdio_fw_cache_lock */
+static struct {
+	u32		hits;
+	u32		misses;
+	u32		bad;		/* dropped on CRC mismatch */
+	struct lbs_hist	load_time;	/* usecs per download, any source */
+} if_sdio_fw_stats;
+
+static u32 if_sdio_fw_crc(const struct firmware *fw)
+{
+	return crc32_le(~0, fw->data, fw->size);
+}
+
+/* Drops an entry, or leaves it to its last user. Called with the lock held */
+static void if_sdio_fw_cache_drop(struct if_sdio_fw_cache *entry)
+{
+	if (entry->users) {
+		entry->stale = 1;
+		return;
+	}
+
+	release_firmware(entry->fw);
+	entry->fw = NULL;
+	entry->stale = 0;
+}
+
+static const struct firmware *if_sdio_fw_cache_get(int model,
+		const char *name)
+{
+	struct if_sdio_fw_cache *entry;
+	const struct firmware *fw = NULL;
+	int i;
+
+	mutex_lock(&if_sdio_fw_cache_lock);
+
+	for (i = 0; i < ARRAY_SIZE(if_sdio_fw_cache); i++) {
+		entry = &if_sdio_fw_cache[i];
+		if (!entry->fw || entry->stale || entry->model != model ||
+		    strcmp(entry->name, name))
+			continue;
+
+		if (if_sdio_fw_crc(entry->fw) != entry->crc) {
+			lbs_pr_err("cached %s is corrupt, reloading\n", name);
+			if_sdio_fw_cache_drop(entry);
+			if_sdio_fw_stats.bad++;
+			break;
+		}
+
+		entry->users++;
+		fw = entry->fw;
+		break;
+	}
+
+	if (fw)
+		if_sdio_fw_stats.hits++;
+	else
+		if_sdio_fw_stats.misses++;
+
+	mutex_unlock(&if_sdio_fw_cache_lock);
+
+	return fw;
+}
+
+/* The cache takes over fw; it is released right away if there's no room */
+static void if_sdio_fw_cache_put(int model, const char *name,
+		const struct firmware *fw)
+{
+	struct if_sdio_fw_cache *entry;
+	int i;
+
+	mutex_lock(&if_sdio_fw_cache_lock);
+
+	for (i = 0; i < ARRAY_SIZE(if_sdio_fw_cache); i++) {
+		entry = &if_sdio_fw_cache[i];
+		if (entry->fw)
+			continue;
+
+		entry->model = model;
+		entry->name = name;
+		entry->fw = fw;
+		entry->crc = if_sdio_fw_crc(fw);
+		entry->users = 0;
+		entry->stale = 0;
+		fw = NULL;
+		break;
+	}
+
+	mutex_unlock(&if_sdio_fw_cache_lock);
 
-	return ret;
+	release_firmware(fw);
 }
 
-static void if_sdio_host_to_card_worker(struct work_struct *work)
+/* Gives back an image returned by if_sdio_fw_cache_get() */
+static void if_sdio_fw_cache_release(const struct firmware *fw)
 {
-	struct if_sdio_card *card;
-	struct if_sdio_packet *packet;
-	unsigned long timeout;
-	u8 status;
-	int ret;
-	unsigned long flags;
+	struct if_sdio_fw_cache *entry;
+	int i;
 
-	lbs_deb_enter(LBS_DEB_SDIO);
+	if (!fw)
+		return;
 
-	card = container_of(work, struct if_sdio_card, packet_worker);
+	mutex_lock(&if_sdio_fw_cache_lock);
 
-	while (1) {
-		spin_lock_irqsave(&card->lock, flags);
-		packet = card->packets;
-		if (packet)
-			card->packets = packet->next;
-		spin_unlock_irqrestore(&card->lock, flags);
+	for (i = 0; i < ARRAY_SIZE(if_sdio_fw_cache); i++) {
+		entry = &if_sdio_fw_cache[i];
+		if (entry->fw != fw)
+			continue;
 
-		if (!packet)
-			break;
+		if (--entry->users == 0 && entry->stale)
+			if_sdio_fw_cache_drop(entry);
+		break;
+	}
 
-		sdio_claim_host(card->func);
+	mutex_unlock(&if_sdio_fw_cache_lock);
+}
 
-		timeout = jiffies + HZ;
-		while (1) {
-			status = sdio_readb(card->func, IF_SDIO_STATUS, &ret);
-			if (ret)
-				goto release;
-			if (status & IF_SDIO_IO_RDY)
-				break;
-			if (time_after(jiffies, timeout)) {
-				ret = -ETIMEDOUT;
-				goto release;
-			}
-			mdelay(1);
-		}
+static void if_sdio_fw_cache_flush(void)
+{
+	int i;
 
-		ret = sdio_writesb(card->func, card->ioport,
-				packet->buffer, packet->nb);
-		if (ret)
-			goto release;
-release:
-		sdio_release_host(card->func);
+	mutex_lock(&if_sdio_fw_cache_lock);
+	for (i = 0; i < ARRAY_SIZE(if_sdio_fw_cache); i++)
+		if (if_sdio_fw_cache[i].fw)
+			if_sdio_fw_cache_drop(&if_sdio_fw_cache[i]);
+	mutex_unlock(&if_sdio_fw_cache_lock);
+}
 
-		kfree(packet);
+/*
+ * Sleeps between polls of a firmware boot handshake. The slow path keeps
+ * the historical 10ms naps; the fast path starts at IF_SDIO_WAIT_MIN_US
+ * and backs off to 10ms so a quick boot is noticed quickly.
+ */
+static void if_sdio_fw_boot_sleep(unsigned long *delay)
+{
+	if (!if_sdio_fast_fw) {
+		msleep(10);
+		return;
 	}
 
-	lbs_deb_leave(LBS_DEB_SDIO);
+	if_sdio_usleep(*delay);
+	*delay = min(*delay * 2, 10000UL);
 }
 
-/********************************************************************/
-/* Firmware                                                         */
-/********************************************************************/
-
-static int if_sdio_prog_helper(struct if_sdio_card *card)
+static int if_sdio_prog_helper(struct if_sdio_card *card,
+		const struct firmware *fw)
 {
 	int ret;
-	u8 status;
-	const struct firmware *fw;
 	unsigned long timeout;
+	unsigned long delay = IF_SDIO_WAIT_MIN_US;
 	u8 *chunk_buffer;
 	u32 chunk_size;
 	u8 *firmware;
 	size_t size;
+	ktime_t start;
 
 	lbs_deb_enter(LBS_DEB_SDIO);
 
-	ret = request_firmware(&fw, card->helper, &card->func->dev);
-	if (ret) {
-		lbs_pr_err("can't load helper firmware\n");
-		goto out;
-	}
-
 	chunk_buffer = kzalloc(64, GFP_KERNEL);
 	if (!chunk_buffer) {
 		ret = -ENOMEM;
-		goto release_fw;
+		goto out;
 	}
 
 	sdio_claim_host(card->func);
@@ -502,21 +1470,14 @@ static int if_sdio_prog_helper(struct if_sdio_card *card)
 	firmware = fw->data;
 	size = fw->size;
 
+	start = ktime_get();
+
 	while (size) {
-		timeout = jiffies + HZ;
-		while (1) {
-			status = sdio_readb(card->func, IF_SDIO_STATUS, &ret);
-			if (ret)
-				goto release;
-			if ((status & IF_SDIO_IO_RDY) &&
-					(status & IF_SDIO_DL_RDY))
-				break;
-			if (time_after(jiffies, timeout)) {
-				ret = -ETIMEDOUT;
-				goto release;
-			}
-			mdelay(1);
-		}
+		ret = if_sdio_wait_status(card,
+				IF_SDIO_IO_RDY | IF_SDIO_DL_RDY,
+				IF_SDIO_WAIT_HELPER);
+		if (ret)
+			goto release;
 
 		chunk_size = min(size, (size_t)60);
 
@@ -540,9 +1501,12 @@ static int if_sdio_prog_helper(struct if_sdio_card *card)
 	if (ret)
 		goto release;
 
+	card->fw_time.helper_us = lbs_usecs_since(start);
+
 	lbs_deb_sdio("waiting for helper to boot...\n");
 
 	/* wait for the helper to boot by looking at the size register */
+	start = ktime_get();
 	timeout = jiffies + HZ;
 	while (1) {
 		u16 req_size;
@@ -563,17 +1527,16 @@ static int if_sdio_prog_helper(struct if_sdio_card *card)
 			goto release;
 		}
 
-		msleep(10);
+		if_sdio_fw_boot_sleep(&delay);
 	}
 
+	card->fw_time.helper_boot_us = lbs_usecs_since(start);
 	ret = 0;
 
 release:
 	sdio_set_block_size(card->func, 0);
 	sdio_release_host(card->func);
 	kfree(chunk_buffer);
-release_fw:
-	release_firmware(fw);
 
 out:
 	if (ret)
@@ -584,55 +1547,78 @@ out:
 	return ret;
 }
 
-static int if_sdio_prog_real(struct if_sdio_card *card)
+/*
+ * Picks the block size and staging buffer for the main image. The slow
+ * path keeps the historical 32 byte blocks and 512 byte buffer. The
+ * fast path uses the largest block size both card and host accept and
+ * a buffer big enough for a whole helper request. Chunks are padded to
+ * the block size either way, so each one is a single transaction.
+ */
+static u8 *if_sdio_alloc_fw_buffer(struct if_sdio_card *card,
+		unsigned int *blksz, size_t *bufsize)
+{
+	struct mmc_host *host = card->func->card->host;
+	u8 *buf;
+
+	*blksz = 32;
+	*bufsize = 512;
+
+	if (if_sdio_fast_fw) {
+		*blksz = min(card->func->max_blksize, host->max_blk_size);
+		*bufsize = min(IF_SDIO_FW_CHUNK_MAX, host->max_req_size);
+		*bufsize = max(*bufsize - *bufsize % *blksz, (size_t)*blksz);
+	}
+
+	while (1) {
+		buf = kzalloc(*bufsize, GFP_KERNEL);
+		if (buf || *bufsize <= *blksz)
+			return buf;
+		*bufsize /= 2;
+		*bufsize = max(*bufsize - *bufsize % *blksz, (size_t)*blksz);
+	}
+}
+
+static int if_sdio_prog_real(struct if_sdio_card *card,
+		const struct firmware *fw)
 {
 	int ret;
-	u8 status;
-	const struct firmware *fw;
 	unsigned long timeout;
+	unsigned long delay = IF_SDIO_WAIT_MIN_US;
 	u8 *chunk_buffer;
 	u32 chunk_size;
 	u8 *firmware;
-	size_t size, req_size;
+	size_t size, req_size, bufsize;
+	unsigned int blksz;
+	ktime_t start;
 
 	lbs_deb_enter(LBS_DEB_SDIO);
 
-	ret = request_firmware(&fw, card->firmware, &card->func->dev);
-	if (ret) {
-		lbs_pr_err("can't load firmware\n");
-		goto out;
-	}
-
-	chunk_buffer = kzalloc(512, GFP_KERNEL);
+	chunk_buffer = if_sdio_alloc_fw_buffer(card, &blksz, &bufsize);
 	if (!chunk_buffer) {
 		ret = -ENOMEM;
-		goto release_fw;
+		goto out;
 	}
 
 	sdio_claim_host(card->func);
 
-	ret = sdio_set_block_size(card->func, 32);
+	ret = sdio_set_block_size(card->func, blksz);
 	if (ret)
 		goto release;
 
+	lbs_deb_sdio("firmware download: %u byte blocks, %zu byte chunks\n",
+		blksz, bufsize);
+
 	firmware = fw->data;
 	size = fw->size;
 
+	start = ktime_get();
+
 	while (size) {
-		timeout = jiffies + HZ;
-		while (1) {
-			status = sdio_readb(card->func, IF_SDIO_STATUS, &ret);
-			if (ret)
-				goto release;
-			if ((status & IF_SDIO_IO_RDY) &&
-					(status & IF_SDIO_DL_RDY))
-				break;
-			if (time_after(jiffies, timeout)) {
-				ret = -ETIMEDOUT;
-				goto release;
-			}
-			mdelay(1);
-		}
+		ret = if_sdio_wait_status(card,
+				IF_SDIO_IO_RDY | IF_SDIO_DL_RDY,
+				IF_SDIO_WAIT_FW);
+		if (ret)
+			goto release;
 
 		req_size = sdio_readb(card->func, IF_SDIO_RD_BASE, &ret);
 		if (ret)
@@ -660,15 +1646,19 @@ static int if_sdio_prog_real(struct if_sdio_card *card)
 			req_size = size;
 
 		while (req_size) {
-			chunk_size = min(req_size, (size_t)512);
+			chunk_size = min(req_size, bufsize);
 
+			/*
+			 * fw->data comes from vmalloc() and may not be DMA-able,
+			 * so it is always staged through chunk_buffer.
+			 */
 			memcpy(chunk_buffer, firmware, chunk_size);
 /*
 			lbs_deb_sdio("sending %d bytes (%d bytes) chunk\n",
-				chunk_size, (chunk_size + 31) / 32 * 32);
+				chunk_size, roundup(chunk_size, blksz));
 */
 			ret = sdio_writesb(card->func, card->ioport,
-				chunk_buffer, (chunk_size + 31) / 32 * 32);
+				chunk_buffer, roundup(chunk_size, blksz));
 			if (ret)
 				goto release;
 
@@ -678,11 +1668,13 @@ static int if_sdio_prog_real(struct if_sdio_card *card)
 		}
 	}
 
+	card->fw_time.image_us = lbs_usecs_since(start);
 	ret = 0;
 
 	lbs_deb_sdio("waiting for firmware to boot...\n");
 
 	/* wait for the firmware to boot */
+	start = ktime_get();
 	timeout = jiffies + HZ;
 	while (1) {
 		u16 scratch;
@@ -699,17 +1691,16 @@ static int if_sdio_prog_real(struct if_sdio_card *card)
 			goto release;
 		}
 
-		msleep(10);
+		if_sdio_fw_boot_sleep(&delay);
 	}
 
+	card->fw_time.boot_us = lbs_usecs_since(start);
 	ret = 0;
 
 release:
 	sdio_set_block_size(card->func, 0);
 	sdio_release_host(card->func);
 	kfree(chunk_buffer);
-release_fw:
-	release_firmware(fw);
 
 out:
 	if (ret)
@@ -720,10 +1711,30 @@ out:
 	return ret;
 }
 
+/* Completion for the main image requested in the background */
+struct if_sdio_fw_request {
+	struct completion	done;
+	const struct firmware	*fw;
+};
+
+static void if_sdio_fw_requested(const struct firmware *fw, void *context)
+{
+	struct if_sdio_fw_request *req = context;
+
+	req->fw = fw;
+	complete(&req->done);
+}
+
 static int if_sdio_prog_firmware(struct if_sdio_card *card)
 {
 	int ret;
 	u16 scratch;
+	const struct firmware *helper;
+	const struct firmware *fw;
+	struct if_sdio_fw_request req;
+	int helper_cached, fw_cached;
+	int pending = 0;
+	ktime_t start = ktime_get();
 
 	lbs_deb_enter(LBS_DEB_SDIO);
 
@@ -739,11 +1750,89 @@ static int if_sdio_prog_firmware(struct if_sdio_card *card)
 		goto success;
 	}
 
-	ret = if_sdio_prog_helper(card);
+	memset(&card->fw_time, 0, sizeof(card->fw_time));
+
+	helper = if_sdio_fw_cache_get(card->model, card->helper);
+	helper_cached = helper != NULL;
+	fw = if_sdio_fw_cache_get(card->model, card->firmware);
+	fw_cached = fw != NULL;
+
+	/*
+	 * In fast mode the main image is fetched from userspace while the
+	 * helper is being pushed to the card.
+	 */
+	if (!fw_cached && if_sdio_fast_fw) {
+		init_completion(&req.done);
+		req.fw = NULL;
+		ret = request_firmware_nowait(THIS_MODULE, 1, card->firmware,
+				&card->func->dev, &req, if_sdio_fw_requested);
+		if (ret == 0)
+			pending = 1;
+	}
+
+	if (!helper_cached) {
+		ret = request_firmware(&helper, card->helper,
+				&card->func->dev);
+		if (ret) {
+			lbs_pr_err("can't load helper firmware\n");
+			helper = NULL;
+			goto release;
+		}
+	}
+
+	ret = if_sdio_prog_helper(card, helper);
 	if (ret)
-		goto out;
+		goto release;
+
+	if (pending) {
+		wait_for_completion(&req.done);
+		pending = 0;
+		fw = req.fw;
+		if (!fw)
+			ret = -ENOENT;
+	} else if (!fw_cached)
+		ret = request_firmware(&fw, card->firmware, &card->func->dev);
+	if (ret) {
+		lbs_pr_err("can't load firmware\n");
+		fw = NULL;
+		goto release;
+	}
+
+	ret = if_sdio_prog_real(card, fw);
+	if (ret)
+		goto release;
+
+	card->fw_time.total_us = lbs_usecs_since(start);
+	card->fw_time.cached = helper_cached && fw_cached;
+
+	mutex_lock(&if_sdio_fw_cache_lock);
+	lbs_hist_add(&if_sdio_fw_stats.load_time, card->fw_time.total_us);
+	mutex_unlock(&if_sdio_fw_cache_lock);
+
+	/* both images just booted the card, keep them */
+	if (!helper_cached) {
+		if_sdio_fw_cache_put(card->model, card->helper, helper);
+		helper = NULL;
+	}
+	if (!fw_cached) {
+		if_sdio_fw_cache_put(card->model, card->firmware, fw);
+		fw = NULL;
+	}
+
+release:
+	if (pending) {
+		wait_for_completion(&req.done);
+		fw = req.fw;
+	}
+	if (fw_cached)
+		if_sdio_fw_cache_release(fw);
+	else
+		release_firmware(fw);
+	if (helper_cached)
+		if_sdio_fw_cache_release(helper);
+	else
+		release_firmware(helper);
 
-	ret = if_sdio_prog_real(card);
 	if (ret)
 		goto out;
 
@@ -756,6 +1845,170 @@ out:
 	return ret;
 }
 
+/*******************************************************************/
+/* Debugfs                                                         */
+/*******************************************************************/
+
+static int if_sdio_debugfs_open(struct inode *inode, struct file *file)
+{
+	file->private_data = inode->i_private;
+	return 0;
+}
+
+/* Histograms of sdio_stats, copied before they are formatted */
+struct if_sdio_stats_snap {
+	struct lbs_hist		rx_per_poll;
+	struct lbs_hist		rx_latency;
+	struct lbs_hist		wait[IF_SDIO_WAIT_NR];
+	struct lbs_hist		job_wait[IF_SDIO_JOB_NR];
+	struct lbs_hist		service;
+	struct lbs_hist		claim_txns;
+	struct lbs_hist		fw_load;
+	struct lbs_hist		aggr_frames;
+	struct lbs_hist		aggr_size;
+};
+
+/* The counter lines take well under 2k */
+#define IF_SDIO_STATS_BUFSIZE	(2048 + LBS_HIST_PRINT_MAX * \
+	(sizeof(struct if_sdio_stats_snap) / sizeof(struct lbs_hist)))
+
+static ssize_t if_sdio_debugfs_stats(struct file *file, char __user *userbuf,
+		size_t count, loff_t *ppos)
+{
+	struct if_sdio_card *card = file->private_data;
+	struct if_sdio_stats_snap *snap;
+	const size_t len = IF_SDIO_STATS_BUFSIZE;
+	size_t pos = 0;
+	char *buf;
+	char name[16];
+	ssize_t res;
+	int i;
+
+	snap = kmalloc(sizeof(*snap), GFP_KERNEL);
+	buf = vmalloc(len);
+	if (!snap || !buf) {
+		res = -ENOMEM;
+		goto out;
+	}
+
+	/* Copy the histograms first, the worker keeps updating them */
+	snap->rx_per_poll = card->rx_per_poll;
+	snap->rx_latency = card->rx_latency;
+	memcpy(snap->wait, card->wait_hist, sizeof(snap->wait));
+	memcpy(snap->job_wait, card->job_wait, sizeof(snap->job_wait));
+	snap->service = card->service_time;
+	snap->claim_txns = card->claim_txns;
+	snap->aggr_frames = card->aggr_frames;
+	snap->aggr_size = card->aggr_size;
+
+	pos += scnprintf(buf+pos, len-pos, "cmd_queue = %u (max %u)\n",
+				card->cmd_depth, card->cmd_hiwat);
+	pos += scnprintf(buf+pos, len-pos, "data_queue = %u (max %u)\n",
+				card->data_depth, card->data_hiwat);
+	pos += scnprintf(buf+pos, len-pos, "pool_size = %u\n",
+				card->pool_count);
+	pos += scnprintf(buf+pos, len-pos, "pool_bufsize = %u\n",
+				card->pool_bufsize);
+	pos += scnprintf(buf+pos, len-pos, "pool_free = %u\n",
+				card->pool_free);
+	pos += scnprintf(buf+pos, len-pos, "pool_low = %u\n",
+				card->pool_low);
+	pos += scnprintf(buf+pos, len-pos, "pool_hits = %u\n",
+				card->pool_hits);
+	pos += scnprintf(buf+pos, len-pos, "pool_misses = %u\n",
+				card->pool_misses);
+	pos += scnprintf(buf+pos, len-pos, "alloc_failures = %u\n",
+				card->alloc_failures);
+
+	pos += scnprintf(buf+pos, len-pos, "rx_budget_hits = %u\n",
+				card->rx_budget_hits);
+	pos += scnprintf(buf+pos, len-pos, "rx_fallback_reads = %u\n",
+				card->rx_fallback_reads);
+	pos += lbs_hist_print(buf+pos, len-pos, "rx_per_poll", "uploads",
+			&snap->rx_per_poll);
+	pos += lbs_hist_print(buf+pos, len-pos, "rx_latency", "us",
+			&snap->rx_latency);
+	pos += scnprintf(buf+pos, len-pos, "wait_timeouts = %u\n",
+				card->wait_timeouts);
+	for (i = 0; i < IF_SDIO_WAIT_NR; i++)
+		pos += lbs_hist_print(buf+pos, len-pos, if_sdio_wait_names[i],
+				"us", &snap->wait[i]);
+	for (i = 0; i < IF_SDIO_JOB_NR; i++) {
+		snprintf(name, sizeof(name), "%s_queued",
+				if_sdio_job_names[i]);
+		pos += lbs_hist_print(buf+pos, len-pos, name, "us",
+				&snap->job_wait[i]);
+	}
+	pos += lbs_hist_print(buf+pos, len-pos, "service", "us",
+			&snap->service);
+	pos += scnprintf(buf+pos, len-pos, "claims = %u\n", card->claims);
+	pos += scnprintf(buf+pos, len-pos, "status_reads = %u\n",
+				card->status_reads);
+	pos += scnprintf(buf+pos, len-pos, "tx_budget_hits = %u\n",
+				card->tx_budget_hits);
+	pos += lbs_hist_print(buf+pos, len-pos, "claim_txns", "txns",
+			&snap->claim_txns);
+
+	pos += scnprintf(buf+pos, len-pos, "fw_helper = %u us\n",
+				card->fw_time.helper_us);
+	pos += scnprintf(buf+pos, len-pos, "fw_helper_boot = %u us\n",
+				card->fw_time.helper_boot_us);
+	pos += scnprintf(buf+pos, len-pos, "fw_image = %u us\n",
+				card->fw_time.image_us);
+	pos += scnprintf(buf+pos, len-pos, "fw_boot = %u us\n",
+				card->fw_time.boot_us);
+	pos += scnprintf(buf+pos, len-pos, "fw_total = %u us%s\n",
+				card->fw_time.total_us,
+				card->fw_time.cached ? " (cached)" : "");
+
+	mutex_lock(&if_sdio_fw_cache_lock);
+	pos += scnprintf(buf+pos, len-pos, "fw_cache_hits = %u\n",
+				if_sdio_fw_stats.hits);
+	pos += scnprintf(buf+pos, len-pos, "fw_cache_misses = %u\n",
+				if_sdio_fw_stats.misses);
+	pos += scnprintf(buf+pos, len-pos, "fw_cache_bad = %u\n",
+				if_sdio_fw_stats.bad);
+	snap->fw_load = if_sdio_fw_stats.load_time;
+	mutex_unlock(&if_sdio_fw_cache_lock);
+	pos += lbs_hist_print(buf+pos, len-pos, "fw_load", "us",
+			&snap->fw_load);
+
+	if (card->aggr_buf) {
+		pos += lbs_hist_print(buf+pos, len-pos, "aggr_frames",
+				"frames", &snap->aggr_frames);
+		pos += lbs_hist_print(buf+pos, len-pos, "aggr_size",
+				"bytes", &snap->aggr_size);
+	}
+
+	res = simple_read_from_buffer(userbuf, count, ppos, buf, pos);
+
+out:
+	vfree(buf);
+	kfree(snap);
+	return res;
+}
+
+static const struct file_operations if_sdio_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = if_sdio_debugfs_open,
+	.read = if_sdio_debugfs_stats,
+};
+
+static void if_sdio_debugfs_init(struct if_sdio_card *card)
+{
+	if (!card->priv->debugfs_dir)
+		return;
+
+	card->debugfs_stats = debugfs_create_file("sdio_stats", 0444,
+			card->priv->debugfs_dir, card, &if_sdio_stats_fops);
+}
+
+static void if_sdio_debugfs_remove(struct if_sdio_card *card)
+{
+	debugfs_remove(card->debugfs_stats);
+	card->debugfs_stats = NULL;
+}
+
 /*******************************************************************/
 /* Libertas callbacks                                              */
 /*******************************************************************/
@@ -765,7 +2018,7 @@ static int if_sdio_host_to_card(struct lbs_private *priv,
 {
 	int ret;
 	struct if_sdio_card *card;
-	struct if_sdio_packet *packet, *cur;
+	struct if_sdio_packet *packet;
 	u16 size;
 	unsigned long flags;
 
@@ -785,14 +2038,12 @@ static int if_sdio_host_to_card(struct lbs_private *priv,
 	 */
 	size = sdio_align_size(card->func, nb + 4);
 
-	packet = kzalloc(sizeof(struct if_sdio_packet) + size,
-			GFP_ATOMIC);
+	packet = if_sdio_get_packet(card, size);
 	if (!packet) {
 		ret = -ENOMEM;
 		goto out;
 	}
 
-	packet->next = NULL;
 	packet->nb = size;
 
 	/*
@@ -804,18 +2055,10 @@ static int if_sdio_host_to_card(struct lbs_private *priv,
 	packet->buffer[3] = 0;
 
 	memcpy(packet->buffer + 4, buf, nb);
+	memset(packet->buffer + 4 + nb, 0, size - (nb + 4));
 
 	spin_lock_irqsave(&card->lock, flags);
 
-	if (!card->packets)
-		card->packets = packet;
-	else {
-		cur = card->packets;
-		while (cur->next)
-			cur = cur->next;
-		cur->next = packet;
-	}
-
 	switch (type) {
 	case MVMS_CMD:
 		priv->dnld_sent = DNLD_CMD_SENT;
@@ -827,9 +2070,107 @@ static int if_sdio_host_to_card(struct lbs_private *priv,
 		lbs_deb_sdio("unknown packet type %d\n", (int)type);
 	}
 
+	if (type == MVMS_CMD) {
+		list_add_tail(&packet->list, &card->cmd_packets);
+		if (++card->cmd_depth > card->cmd_hiwat)
+			card->cmd_hiwat = card->cmd_depth;
+	} else {
+		list_add_tail(&packet->list, &card->data_packets);
+		if (++card->data_depth > card->data_hiwat)
+			card->data_hiwat = card->data_depth;
+	}
+
+	spin_unlock_irqrestore(&card->lock, flags);
+
+	if_sdio_kick(card, IF_SDIO_JOB_TX);
+
+	ret = 0;
+
+out:
+	lbs_deb_leave_args(LBS_DEB_SDIO, "ret %d", ret);
+
+	return ret;
+}
+
+/*
+ * Queues a data skb for the bus worker. The skb is always consumed:
+ * it is freed here if it can't be made big enough, so the caller must
+ * not touch it again whatever the return value.
+ */
+static int if_sdio_host_to_card_skb(struct lbs_private *priv,
+		struct sk_buff *skb)
+{
+	int ret;
+	struct if_sdio_card *card;
+	u16 nb, size;
+	u8 *header;
+	int flush = 1;
+	unsigned long flags;
+
+	lbs_deb_enter_args(LBS_DEB_SDIO, "bytes %d", skb->len);
+
+	card = priv->card;
+	nb = skb->len;
+
+	/*
+	 * The transfer is padded up to the block size straight from
+	 * the skb, so the padding must fit in the tailroom. The core
+	 * reserves the headroom for the SDIO header.
+	 */
+	size = sdio_align_size(card->func, nb + 4);
+
+	if (skb_headroom(skb) < 4 || skb_tailroom(skb) < size - (nb + 4)) {
+		lbs_deb_sdio("reallocating skb (head %d, tail %d)\n",
+			skb_headroom(skb), skb_tailroom(skb));
+		if (pskb_expand_head(skb, 4, size - (nb + 4), GFP_ATOMIC)) {
+			dev_kfree_skb_any(skb);
+			ret = -ENOMEM;
+			goto out;
+		}
+		priv->tx_copy_iface++;
+	}
+
+	/*
+	 * SDIO specific header.
+	 */
+	header = skb_push(skb, 4);
+	header[0] = (nb + 4) & 0xff;
+	header[1] = ((nb + 4) >> 8) & 0xff;
+	header[2] = MVMS_DAT;
+	header[3] = 0;
+
+	/* The padding goes over the bus too, don't leak stale memory */
+	memset(skb_tail_pointer(skb), 0, size - (nb + 4));
+
+	spin_lock_irqsave(&card->lock, flags);
+	__skb_queue_tail(&card->data_skbs, skb);
+	if (++card->data_depth > card->data_hiwat)
+		card->data_hiwat = card->data_depth;
+
+	if (card->aggr_buf) {
+		card->aggr_bytes += if_sdio_aggr_len(card, skb->len);
+
+		/*
+		 * Keep collecting while the core has more frames lined up
+		 * and another full-sized one still fits, so whatever is
+		 * held always goes out as one aggregate. Until then only
+		 * data may follow, see DNLD_DATA_COLLECTING.
+		 */
+		if (!priv->tx_ring_count || card->aggr_bytes +
+		    if_sdio_aggr_len(card, LBS_UPLD_SIZE + 4) > card->aggr_bufsize)
+			card->aggr_flush = 1;
+		flush = card->aggr_flush;
+	}
+
+	/* Called with driver_lock held by the main thread */
+	priv->dnld_sent = flush ? DNLD_DATA_SENT : DNLD_DATA_COLLECTING;
 	spin_unlock_irqrestore(&card->lock, flags);
 
-	schedule_work(&card->packet_worker);
+	if (flush)
+		if_sdio_kick(card, IF_SDIO_JOB_TX);
+	else if (!timer_pending(&card->aggr_timer))
+		mod_timer(&card->aggr_timer,
+			jiffies + usecs_to_jiffies(if_sdio_tx_aggr_timeout));
 
 	ret = 0;
 
@@ -839,6 +2180,32 @@ out:
 	return ret;
 }
 
+/*
+ * Resetting the chip makes the MMC core remove and re-probe the card,
+ * so it can't run from the driver's own threads, which if_sdio_remove()
+ * stops and waits for. The re-probe loads firmware from the cache.
+ */
+static struct workqueue_struct *if_sdio_reset_wq;
+static DEFINE_SPINLOCK(if_sdio_reset_lock);	/* for if_sdio_reset_wq */
+
+static void if_sdio_reset_worker(struct work_struct *work)
+{
+	lbs_pr_info("resetting card\n");
+	sirloin_wifi_reset_and_rescan();
+}
+
+static DECLARE_WORK(if_sdio_reset_work, if_sdio_reset_worker);
+
+static void if_sdio_reset_card(struct lbs_private *priv)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&if_sdio_reset_lock, flags);
+	if (if_sdio_reset_wq)
+		queue_work(if_sdio_reset_wq, &if_sdio_reset_work);
+	spin_unlock_irqrestore(&if_sdio_reset_lock, flags);
+}
+
 /*******************************************************************/
 /* SDIO callbacks                                                  */
 /*******************************************************************/
@@ -847,6 +2214,7 @@ static void if_sdio_interrupt(struct sdio_func *func)
 {
 	int ret;
 	struct if_sdio_card *card;
+	unsigned long flags;
 	u8 cause;
 
 	lbs_deb_enter(LBS_DEB_SDIO);
@@ -854,6 +2222,7 @@ static void if_sdio_interrupt(struct sdio_func *func)
 	card = sdio_get_drvdata(func);
 
 	cause = sdio_readb(card->func, IF_SDIO_H_INT_STATUS, &ret);
+	card->status_reads++;
 	if (ret)
 		goto out;
 
@@ -871,10 +2240,16 @@ static void if_sdio_interrupt(struct sdio_func *func)
 		lbs_host_to_card_done(card->priv);
 
 
+	/* Uploads are read by the RX poll worker */
 	if (cause & IF_SDIO_H_INT_UPLD) {
-		ret = if_sdio_card_to_host(card);
-		if (ret)
-			goto out;
+		spin_lock_irqsave(&card->lock, flags);
+		if (!card->rx_scheduled) {
+			card->rx_scheduled = 1;
+			card->rx_irq_time = ktime_get();
+		}
+		spin_unlock_irqrestore(&card->lock, flags);
+
+		if_sdio_kick(card, IF_SDIO_JOB_RX);
 	}
 
 	ret = 0;
@@ -890,7 +2265,6 @@ static int if_sdio_probe(struct sdio_func *func,
 	struct lbs_private *priv;
 	int ret, i;
 	unsigned int model;
-	struct if_sdio_packet *packet;
 
 	lbs_deb_enter(LBS_DEB_SDIO);
 
@@ -919,7 +2293,13 @@ static int if_sdio_probe(struct sdio_func *func,
 	card->func = func;
 	card->model = model;
 	spin_lock_init(&card->lock);
-	INIT_WORK(&card->packet_worker, if_sdio_host_to_card_worker);
+	INIT_LIST_HEAD(&card->cmd_packets);
+	INIT_LIST_HEAD(&card->data_packets);
+	skb_queue_head_init(&card->data_skbs);
+	INIT_LIST_HEAD(&card->pool);
+	skb_queue_head_init(&card->rx_batch);
+	setup_timer(&card->aggr_timer, if_sdio_aggr_timeout,
+		(unsigned long)card);
 
 	for (i = 0;i < ARRAY_SIZE(if_sdio_models);i++) {
 		if (card->model == if_sdio_models[i].model)
@@ -982,6 +2362,18 @@ static int if_sdio_probe(struct sdio_func *func,
 	if (ret)
 		goto reclaim;
 
+	ret = if_sdio_alloc_pool(card);
+	if (ret)
+		goto reclaim;
+
+	ret = if_sdio_init_aggr(card);
+	if (ret)
+		goto reclaim;
+
+	ret = if_sdio_start_worker(card);
+	if (ret)
+		goto reclaim;
+
 	priv = lbs_add_card(card, &func->dev);
 	if (!priv) {
 		ret = -ENOMEM;
@@ -992,6 +2384,9 @@ static int if_sdio_probe(struct sdio_func *func,
 
 	priv->card = card;
 	priv->hw_host_to_card = if_sdio_host_to_card;
+	priv->hw_host_to_card_skb = if_sdio_host_to_card_skb;
+	priv->hw_tx_headroom = 4;
+	priv->reset_card = if_sdio_reset_card;
 
 	priv->fw_ready = 1;
 
@@ -1008,16 +2403,26 @@ static int if_sdio_probe(struct sdio_func *func,
 	if (ret)
 		goto err_activate_card;
 
+	if_sdio_debugfs_init(card);
+
 out:
 	lbs_deb_leave_args(LBS_DEB_SDIO, "ret %d", ret);
 
 	return ret;
 
 err_activate_card:
-	flush_scheduled_work();
+	/* as in if_sdio_remove(), nothing may touch priv once it's freed */
+	sdio_claim_host(func);
+	sdio_writeb(func, 0, IF_SDIO_H_INT_MASK, NULL);
+	sdio_release_irq(func);
+	sdio_release_host(func);
+	if_sdio_stop_worker(card);
 	free_netdev(priv->dev);
 	kfree(priv);
+	sdio_claim_host(func);
+	goto disable;
 reclaim:
+	if_sdio_stop_worker(card);
 	sdio_claim_host(func);
 release_int:
 	sdio_release_irq(func);
@@ -1026,11 +2431,12 @@ disable:
 release:
 	sdio_release_host(func);
 free:
-	while (card->packets) {
-		packet = card->packets;
-		card->packets = card->packets->next;
-		kfree(packet);
-	}
+	if_sdio_free_packets(&card->cmd_packets);
+	if_sdio_free_packets(&card->data_packets);
+	skb_queue_purge(&card->data_skbs);
+	skb_queue_purge(&card->rx_batch);
+	if_sdio_free_pool(card);
+	if_sdio_free_aggr(card);
 
 	kfree(card);
 
@@ -1040,7 +2446,7 @@ free:
 static void if_sdio_remove(struct sdio_func *func)
 {
 	struct if_sdio_card *card;
-	struct if_sdio_packet *packet;
+	int ret;
 
 	lbs_deb_enter(LBS_DEB_SDIO);
 
@@ -1048,22 +2454,41 @@ static void if_sdio_remove(struct sdio_func *func)
 
 	card->priv->surpriseremoved = 1;
 
+	if_sdio_debugfs_remove(card);
+
+	/*
+	 * The interrupt handler and the bus worker both use priv, so
+	 * they must be gone before the core frees it. Once the
+	 * interrupt is released nothing kicks the worker for RX any
+	 * more; it keeps running until the card is stopped so that
+	 * anything lbs_stop_card() still sends goes out.
+	 */
+	sdio_claim_host(func);
+	sdio_writeb(func, 0, IF_SDIO_H_INT_MASK, &ret);
+	sdio_release_irq(func);
+	sdio_release_host(func);
+
 	lbs_deb_sdio("call remove card\n");
 	lbs_stop_card(card->priv);
-	lbs_remove_card(card->priv);
 
-	flush_scheduled_work();
+	del_timer_sync(&card->aggr_timer);
+
+	/* a poll asked for by the last interrupt is dropped */
+	if_sdio_stop_worker(card);
+	skb_queue_purge(&card->rx_batch);
+
+	lbs_remove_card(card->priv);
 
 	sdio_claim_host(func);
-	sdio_release_irq(func);
 	sdio_disable_func(func);
 	sdio_release_host(func);
 
-	while (card->packets) {
-		packet = card->packets;
-		card->packets = card->packets->next;
-		kfree(packet);
-	}
+	if_sdio_free_packets(&card->cmd_packets);
+	if_sdio_free_packets(&card->data_packets);
+	skb_queue_purge(&card->data_skbs);
+	skb_queue_purge(&card->rx_batch);
+	if_sdio_free_pool(card);
+	if_sdio_free_aggr(card);
 
 	kfree(card);
 
@@ -1094,6 +2519,8 @@ static int __init if_sdio_init_module(void)
 	printk(KERN_INFO "libertas_sdio: Libertas SDIO driver\n");
 	printk(KERN_INFO "libertas_sdio: Copyright Pierre Ossman\n");
 
+	if_sdio_reset_wq = create_singlethread_workqueue("libertas_sdio_reset");
+
 	ret = sdio_register_driver(&if_sdio_driver);
 
 	lbs_deb_leave_args(LBS_DEB_SDIO, "ret %d", ret);
@@ -1103,10 +2530,26 @@ static int __init if_sdio_init_module(void)
 
 static void __exit if_sdio_exit_module(void)
 {
+	struct workqueue_struct *wq;
+	unsigned long flags;
+
 	lbs_deb_enter(LBS_DEB_SDIO);
 
+	/* a pending reset would rescan the slot under the unregister */
+	spin_lock_irqsave(&if_sdio_reset_lock, flags);
+	wq = if_sdio_reset_wq;
+	if_sdio_reset_wq = NULL;
+	spin_unlock_irqrestore(&if_sdio_reset_lock, flags);
+
+	if (wq) {
+		cancel_work_sync(&if_sdio_reset_work);
+		destroy_workqueue(wq);
+	}
+
 	sdio_unregister_driver(&if_sdio_driver);
 
+	if_sdio_fw_cache_flush();
+
 	lbs_deb_leave(LBS_DEB_SDIO);
 	
 	lbs_exit_module();
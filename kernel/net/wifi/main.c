@@ -11,7 +11,9 @@
 #include <linux/if_arp.h>
 #include <linux/kthread.h>
 #include <linux/kfifo.h>
+#include <linux/vmalloc.h>
 #include <linux/stddef.h>
+#include <linux/ctype.h>
 
 #include <net/iw_handler.h>
 #include <net/ieee80211.h>
@@ -38,6 +40,13 @@ unsigned int lbs_debug;
 EXPORT_SYMBOL_GPL(lbs_debug);
 module_param_named(libertas_debug, lbs_debug, int, 0644);
 
+static unsigned int lbs_tx_ring_depth = LBS_TX_RING_DEPTH;
+module_param_named(tx_ring_depth, lbs_tx_ring_depth, uint, 0444);
+
+/* msecs between GET_LOG refreshes for wireless stats, 0 to query per read */
+static unsigned int lbs_stats_interval = 1000;
+module_param_named(stats_interval, lbs_stats_interval, uint, 0644);
+
 
 /* This global structure is used to send the confirm_sleep command as
  * fast as possible down to the firmware. */
@@ -305,10 +314,14 @@ static ssize_t lbs_rtap_set(struct device *dev,
 		priv->monitormode = 0;
 		lbs_remove_rtap(priv);
 
+		cancel_delayed_work_sync(&priv->hop_work);
+
+		lbs_spin_lock_irq(&priv->tx_lock, &priv->tx_lock_stats);
 		if (priv->currenttxskb) {
 			dev_kfree_skb_any(priv->currenttxskb);
 			priv->currenttxskb = NULL;
 		}
+		lbs_spin_unlock_irq(&priv->tx_lock, &priv->tx_lock_stats);
 
 		/* Wake queues, command thread, etc. */
 		lbs_host_to_card_done(priv);
@@ -317,6 +330,10 @@ static ssize_t lbs_rtap_set(struct device *dev,
 	lbs_prepare_and_send_command(priv,
 			CMD_802_11_MONITOR_MODE, CMD_ACT_SET,
 			CMD_OPTION_WAITFORRSP, 0, &priv->monitormode);
+
+	if (priv->monitormode && priv->hop_nr)
+		queue_delayed_work(priv->work_thread, &priv->hop_work, 0);
+
 	return strlen(buf);
 }
 
@@ -326,6 +343,140 @@ static ssize_t lbs_rtap_set(struct device *dev,
  */
 static DEVICE_ATTR(lbs_rtap, 0644, lbs_rtap_get, lbs_rtap_set );
 
+/**
+ *  @brief Moves the monitor to the next channel of the hop list and
+ *  stays there for that channel's dwell time
+ */
+static void lbs_hop_worker(struct work_struct *work)
+{
+	struct lbs_private *priv = container_of(work, struct lbs_private,
+		hop_work.work);
+	int i;
+
+	lbs_deb_enter(LBS_DEB_MAIN);
+
+	if (!priv->monitormode || !priv->hop_nr)
+		goto out;
+
+	i = priv->hop_idx;
+	if (lbs_set_channel(priv, priv->hop_chan[i]))
+		priv->hop_failures++;
+	else
+		priv->hops++;
+	priv->hop_idx = (i + 1) % priv->hop_nr;
+
+	queue_delayed_work(priv->work_thread, &priv->hop_work,
+		msecs_to_jiffies(priv->hop_dwell[i]));
+out:
+	lbs_deb_leave(LBS_DEB_MAIN);
+}
+
+/**
+ * Get function for sysfs attribute rtap_hop
+ */
+static ssize_t lbs_rtap_hop_get(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct lbs_private *priv = to_net_dev(dev)->priv;
+	size_t pos = 0;
+	int i;
+
+	for (i = 0; i < priv->hop_nr; i++)
+		pos += snprintf(buf + pos, PAGE_SIZE - pos, "%s%u:%u",
+			i ? " " : "", priv->hop_chan[i], priv->hop_dwell[i]);
+	pos += snprintf(buf + pos, PAGE_SIZE - pos, "\n");
+
+	return pos;
+}
+
+/**
+ *  Set function for sysfs attribute rtap_hop. Takes a list of
+ *  channel[:dwell_ms] entries separated by spaces or commas, where
+ *  "all" stands for every channel of the region's CFP table. An empty
+ *  list stops hopping. The hopper only runs in monitor mode.
+ */
+static ssize_t lbs_rtap_hop_set(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct lbs_private *priv = to_net_dev(dev)->priv;
+	u8 chan[LBS_HOP_MAX_CHANNELS];
+	u16 dwell[LBS_HOP_MAX_CHANNELS];
+	struct chan_freq_power *cfp;
+	const char *p = buf;
+	char *end;
+	unsigned long ch, ms;
+	int nr = 0, all, cfp_no, i;
+
+	while (*p) {
+		if (isspace(*p) || *p == ',') {
+			p++;
+			continue;
+		}
+
+		all = !strncmp(p, "all", 3);
+		if (all) {
+			ch = 0;
+			p += 3;
+		} else {
+			ch = simple_strtoul(p, &end, 10);
+			if (end == p)
+				return -EINVAL;
+			p = end;
+		}
+
+		ms = LBS_HOP_DWELL_DEFAULT;
+		if (*p == ':') {
+			ms = simple_strtoul(p + 1, &end, 10);
+			if (end == p + 1)
+				return -EINVAL;
+			p = end;
+		}
+		if (ms < LBS_HOP_DWELL_MIN || ms > LBS_HOP_DWELL_MAX)
+			return -EINVAL;
+
+		if (all) {
+			cfp = lbs_get_region_cfp_table(priv->regioncode,
+				&cfp_no);
+			if (!cfp)
+				return -EINVAL;
+			for (i = 0; i < cfp_no; i++) {
+				if (cfp[i].unsupported)
+					continue;
+				if (nr == LBS_HOP_MAX_CHANNELS)
+					return -E2BIG;
+				chan[nr] = cfp[i].channel;
+				dwell[nr++] = ms;
+			}
+			continue;
+		}
+
+		if (!lbs_find_cfp_by_band_and_channel(priv, 0, ch))
+			return -EINVAL;
+		if (nr == LBS_HOP_MAX_CHANNELS)
+			return -E2BIG;
+		chan[nr] = ch;
+		dwell[nr++] = ms;
+	}
+
+	cancel_delayed_work_sync(&priv->hop_work);
+
+	memcpy(priv->hop_chan, chan, sizeof(chan));
+	memcpy(priv->hop_dwell, dwell, sizeof(dwell));
+	priv->hop_nr = nr;
+	priv->hop_idx = 0;
+
+	if (priv->monitormode && nr)
+		queue_delayed_work(priv->work_thread, &priv->hop_work, 0);
+
+	return count;
+}
+
+/**
+ * rtap_hop attribute to be exported per ethX interface
+ * through sysfs (/sys/class/net/ethX/lbs_rtap_hop)
+ */
+static DEVICE_ATTR(lbs_rtap_hop, 0644, lbs_rtap_hop_get, lbs_rtap_hop_set);
+
 /**
  * Get function for sysfs attribute mesh
  */
@@ -418,7 +569,7 @@ static int lbs_dev_open(struct net_device *dev)
 			netif_carrier_off(dev);
 	}
 
-	if (!priv->tx_pending_len)
+	if (!lbs_tx_ring_full(priv))
 		netif_wake_queue(dev);
  out:
 
@@ -448,7 +599,7 @@ static int lbs_mesh_stop(struct net_device *dev)
 
 	spin_unlock_irq(&priv->driver_lock);
 
-	schedule_work(&priv->mcast_work);
+	queue_work(priv->work_thread, &priv->mcast_work);
 
 	lbs_deb_leave(LBS_DEB_MESH);
 	return 0;
@@ -471,7 +622,7 @@ static int lbs_eth_stop(struct net_device *dev)
 	netif_stop_queue(dev);
 	spin_unlock_irq(&priv->driver_lock);
 
-	schedule_work(&priv->mcast_work);
+	queue_work(priv->work_thread, &priv->mcast_work);
 
 	lbs_deb_leave(LBS_DEB_NET);
 	return 0;
@@ -510,15 +661,19 @@ void lbs_host_to_card_done(struct lbs_private *priv)
 
 	lbs_deb_enter(LBS_DEB_THREAD);
 
-	spin_lock_irqsave(&priv->driver_lock, flags);
+	lbs_tx_trace_done(priv);
+
+	lbs_spin_lock_irqsave(&priv->driver_lock, &priv->driver_lock_stats,
+			      flags);
 
 	priv->dnld_sent = DNLD_RES_RECEIVED;
 
 	/* Wake main thread if commands are pending */
-	if (!priv->cur_cmd || priv->tx_pending_len > 0)
+	if (!priv->cur_cmd || lbs_tx_ring_ready(priv))
 		wake_up_interruptible(&priv->waitq);
 
-	spin_unlock_irqrestore(&priv->driver_lock, flags);
+	lbs_spin_unlock_irqrestore(&priv->driver_lock, &priv->driver_lock_stats,
+				   flags);
 	lbs_deb_leave(LBS_DEB_THREAD);
 }
 EXPORT_SYMBOL_GPL(lbs_host_to_card_done);
@@ -676,7 +831,7 @@ static void lbs_set_multicast_list(struct net_device *dev)
 {
 	struct lbs_private *priv = dev->priv;
 
-	schedule_work(&priv->mcast_work);
+	queue_work(priv->work_thread, &priv->mcast_work);
 }
 
 /**
@@ -706,7 +861,7 @@ static int lbs_thread(void *data)
 
 		add_wait_queue(&priv->waitq, &wait);
 		set_current_state(TASK_INTERRUPTIBLE);
-		spin_lock_irq(&priv->driver_lock);
+		lbs_spin_lock_irq(&priv->driver_lock, &priv->driver_lock_stats);
 
 		if (kthread_should_stop())
 			shouldsleep = 0;	/* Bye */
@@ -718,9 +873,12 @@ static int lbs_thread(void *data)
 			shouldsleep = 0;	/* Command timed out. Recover */
 		else if (!priv->fw_ready)
 			shouldsleep = 1;	/* Firmware not ready. We're waiting for it */
+		else if (priv->dnld_sent == DNLD_DATA_COLLECTING &&
+			 lbs_tx_ring_ready(priv))
+			shouldsleep = 0;	/* Another packet for the aggregate */
 		else if (priv->dnld_sent)
 			shouldsleep = 1;	/* Something is en route to the device already */
-		else if (priv->tx_pending_len > 0)
+		else if (lbs_tx_ring_ready(priv))
 			shouldsleep = 0;	/* We've a packet to send */
 		else if (priv->resp_len[priv->resp_idx])
 			shouldsleep = 0;	/* We have a command response */
@@ -738,10 +896,12 @@ static int lbs_thread(void *data)
 				"psmode %d, psstate %d\n",
 				priv->connect_status,
 				priv->psmode, priv->psstate);
-			spin_unlock_irq(&priv->driver_lock);
+			lbs_spin_unlock_irq(&priv->driver_lock,
+					    &priv->driver_lock_stats);
 			schedule();
 		} else
-			spin_unlock_irq(&priv->driver_lock);
+			lbs_spin_unlock_irq(&priv->driver_lock,
+					    &priv->driver_lock_stats);
 
 		lbs_deb_thread("2: currenttxskb %p, dnld_send %d\n",
 			       priv->currenttxskb, priv->dnld_sent);
@@ -766,19 +926,22 @@ static int lbs_thread(void *data)
 		       priv->currenttxskb, priv->dnld_sent);
 
 		/* Process any pending command response */
-		spin_lock_irq(&priv->driver_lock);
+		lbs_spin_lock_irq(&priv->driver_lock, &priv->driver_lock_stats);
 		resp_idx = priv->resp_idx;
 		if (priv->resp_len[resp_idx]) {
-			spin_unlock_irq(&priv->driver_lock);
+			lbs_spin_unlock_irq(&priv->driver_lock,
+					    &priv->driver_lock_stats);
 			lbs_process_command_response(priv,
 				priv->resp_buf[resp_idx],
 				priv->resp_len[resp_idx]);
-			spin_lock_irq(&priv->driver_lock);
+			lbs_spin_lock_irq(&priv->driver_lock,
+					  &priv->driver_lock_stats);
 			priv->resp_len[resp_idx] = 0;
 		}
-		spin_unlock_irq(&priv->driver_lock);
+		lbs_spin_unlock_irq(&priv->driver_lock, &priv->driver_lock_stats);
 
 		/* command timeout stuff */
+		lbs_spin_lock_irq(&priv->driver_lock, &priv->driver_lock_stats);
 		if (priv->cmd_timed_out && priv->cur_cmd) {
 			struct cmd_ctrl_node *cmdnode = priv->cur_cmd;
 
@@ -804,19 +967,17 @@ static int lbs_thread(void *data)
 			}
 		}
 		priv->cmd_timed_out = 0;
+		lbs_spin_unlock_irq(&priv->driver_lock, &priv->driver_lock_stats);
 
-		/* Process hardware events, e.g. card removed, link lost */
-		spin_lock_irq(&priv->driver_lock);
+		/* Process hardware events, e.g. card removed, link lost.
+		   We are the only reader of the fifo, see lbs_queue_event() */
 		while (__kfifo_len(priv->event_fifo)) {
 			u32 event;
 
 			__kfifo_get(priv->event_fifo, (unsigned char *) &event,
 				sizeof(event));
-			spin_unlock_irq(&priv->driver_lock);
 			lbs_process_event(priv, event);
-			spin_lock_irq(&priv->driver_lock);
 		}
-		spin_unlock_irq(&priv->driver_lock);
 
 		if (!priv->fw_ready)
 			continue;
@@ -860,16 +1021,20 @@ static int lbs_thread(void *data)
 		if (!list_empty(&priv->cmdpendingq))
 			wake_up_all(&priv->cmd_pending);
 
-		spin_lock_irq(&priv->driver_lock);
-		if (!priv->dnld_sent && priv->tx_pending_len > 0) {
-			int ret = priv->hw_host_to_card(priv, MVMS_DAT,
-							priv->tx_pending_buf,
-							priv->tx_pending_len);
+		lbs_spin_lock_irq(&priv->driver_lock, &priv->driver_lock_stats);
+		if ((!priv->dnld_sent ||
+		     priv->dnld_sent == DNLD_DATA_COLLECTING) &&
+		    lbs_tx_ring_ready(priv)) {
+			int ret = lbs_tx_ring_send(priv);
 			if (ret) {
 				lbs_deb_tx("host_to_card failed %d\n", ret);
-				priv->dnld_sent = DNLD_RES_RECEIVED;
+				/* frames already collected still own the bus */
+				if (priv->dnld_sent != DNLD_DATA_COLLECTING)
+					priv->dnld_sent = DNLD_RES_RECEIVED;
 			}
-			priv->tx_pending_len = 0;
+			/* Under tx_lock, so hard_start_xmit can't stop the
+			   queues behind our back */
+			lbs_spin_lock(&priv->tx_lock, &priv->tx_lock_stats);
 			if (!priv->currenttxskb) {
 				/* We can wake the queues immediately if we aren't
 				   waiting for TX feedback */
@@ -878,9 +1043,11 @@ static int lbs_thread(void *data)
 				if (priv->mesh_dev &&
 				    priv->mesh_connect_status == LBS_CONNECTED)
 					netif_wake_queue(priv->mesh_dev);
+				lbs_tx_trace_wake(priv);
 			}
+			lbs_spin_unlock(&priv->tx_lock, &priv->tx_lock_stats);
 		}
-		spin_unlock_irq(&priv->driver_lock);
+		lbs_spin_unlock_irq(&priv->driver_lock, &priv->driver_lock_stats);
 	}
 
 	del_timer(&priv->command_timer);
@@ -1000,6 +1167,124 @@ out:
 	lbs_deb_leave(LBS_DEB_CMD);
 }
 
+static int lbs_stats_wanted(struct lbs_private *priv)
+{
+	if (priv->connect_status == LBS_CONNECTED && netif_running(priv->dev))
+		return 1;
+	if (priv->mesh_connect_status == LBS_CONNECTED && priv->mesh_dev &&
+	    netif_running(priv->mesh_dev))
+		return 1;
+	return 0;
+}
+
+static void lbs_store_stats_log(struct lbs_private *priv,
+	const struct cmd_ds_802_11_get_log *log)
+{
+	write_seqlock(&priv->stats_lock);
+	priv->stats_log = *log;
+	priv->stats_time = jiffies ? jiffies : 1;
+	priv->stats_refreshes++;
+	write_sequnlock(&priv->stats_lock);
+}
+
+static int lbs_stats_log_callback(struct lbs_private *priv,
+	unsigned long extra, struct cmd_header *resp)
+{
+	struct cmd_ds_802_11_get_log log;
+
+	memset(&log, 0, sizeof(log));
+	memcpy(&log, resp, min_t(size_t, le16_to_cpu(resp->size),
+				 sizeof(log)));
+	lbs_store_stats_log(priv, &log);
+	return 0;
+}
+
+/*
+ * Asks the firmware for fresh counters. The stats worker shares
+ * work_thread with scanning and association, so it only queues the
+ * GET_LOG and lets the main thread store the response; wait is for
+ * readers that want the answer right away.
+ */
+static void lbs_refresh_stats(struct lbs_private *priv, int wait)
+{
+	struct cmd_ds_802_11_get_log log;
+
+	memset(&log, 0, sizeof(log));
+	log.hdr.size = cpu_to_le16(sizeof(log));
+	if (!wait)
+		lbs_cmd_async_cb(priv, CMD_802_11_GET_LOG, &log.hdr,
+				 sizeof(log), lbs_stats_log_callback, 0);
+	else if (lbs_cmd_with_response(priv, CMD_802_11_GET_LOG, &log) == 0)
+		lbs_store_stats_log(priv, &log);
+
+	/* update the beacon RSSI for the next reader as well */
+	lbs_prepare_and_send_command(priv, CMD_802_11_RSSI, 0,
+				     0, 0, NULL);
+}
+
+/*
+ * Refreshes the cached GET_LOG every stats_interval msecs while an
+ * interface is up and associated and somebody reads the cache. A round
+ * without a read since the previous refresh stops it, so an idle link
+ * doesn't keep waking the chip; the next stale read restarts it.
+ */
+static void lbs_stats_worker(struct work_struct *work)
+{
+	struct lbs_private *priv = container_of(work, struct lbs_private,
+		stats_work.work);
+
+	lbs_deb_enter(LBS_DEB_MAIN);
+
+	if (!lbs_stats_wanted(priv) || !lbs_stats_interval)
+		goto out;
+
+	if (!priv->stats_read)
+		goto out;
+	priv->stats_read = 0;
+
+	lbs_refresh_stats(priv, 0);
+
+	queue_delayed_work(priv->work_thread, &priv->stats_work,
+			   msecs_to_jiffies(lbs_stats_interval));
+out:
+	lbs_deb_leave(LBS_DEB_MAIN);
+}
+
+/**
+ *  @brief Returns the cached GET_LOG counters without talking to the
+ *  firmware. A stale cache gets a refresh scheduled; with stats_interval
+ *  set to 0 the firmware is queried synchronously instead.
+ *
+ *  @param priv    A pointer to struct lbs_private structure
+ *  @param log     Filled with the cached counters
+ *  @return 	   Age of the counters in msecs, or -ENODATA if there are none yet
+ */
+int lbs_get_cached_log(struct lbs_private *priv,
+	struct cmd_ds_802_11_get_log *log)
+{
+	unsigned long time;
+	unsigned int seq;
+
+	if (!lbs_stats_interval)
+		lbs_refresh_stats(priv, 1);
+	else
+		priv->stats_read = 1;
+
+	do {
+		seq = read_seqbegin(&priv->stats_lock);
+		*log = priv->stats_log;
+		time = priv->stats_time;
+	} while (read_seqretry(&priv->stats_lock, seq));
+
+	if (lbs_stats_interval && (!time || time_after(jiffies,
+			time + msecs_to_jiffies(lbs_stats_interval))))
+		queue_delayed_work(priv->work_thread, &priv->stats_work, 0);
+
+	if (!time)
+		return -ENODATA;
+	return jiffies_to_msecs(jiffies - time);
+}
+
 static void lbs_sync_channel_worker(struct work_struct *work)
 {
 	struct lbs_private *priv = container_of(work, struct lbs_private,
@@ -1020,7 +1305,7 @@ static int lbs_init_adapter(struct lbs_private *priv)
 	lbs_deb_enter(LBS_DEB_MAIN);
 
 	/* Allocate buffer to store the BSSID list */
-	bufsize = MAX_NETWORK_COUNT * sizeof(struct bss_descriptor);
+	bufsize = LBS_BSS_SLOTS * sizeof(struct bss_descriptor);
 	priv->networks = kzalloc(bufsize, GFP_KERNEL);
 	if (!priv->networks) {
 		lbs_pr_err("Out of memory allocating beacons\n");
@@ -1031,9 +1316,17 @@ static int lbs_init_adapter(struct lbs_private *priv)
 	/* Initialize scan result lists */
 	INIT_LIST_HEAD(&priv->network_free_list);
 	INIT_LIST_HEAD(&priv->network_list);
-	for (i = 0; i < MAX_NETWORK_COUNT; i++) {
+	INIT_LIST_HEAD(&priv->network_age_list);
+	for (i = 0; i < LBS_BSS_SLOTS; i++) {
 		list_add_tail(&priv->networks[i].list,
 			      &priv->network_free_list);
+		INIT_HLIST_NODE(&priv->networks[i].bssid_node);
+		INIT_HLIST_NODE(&priv->networks[i].ssid_node);
+		INIT_LIST_HEAD(&priv->networks[i].age_list);
+	}
+	for (i = 0; i < LBS_BSS_HASH_SIZE; i++) {
+		INIT_HLIST_HEAD(&priv->bss_bssid_hash[i]);
+		INIT_HLIST_HEAD(&priv->bss_ssid_hash[i]);
 	}
 
 	memset(priv->current_addr, 0xff, ETH_ALEN);
@@ -1049,6 +1342,7 @@ static int lbs_init_adapter(struct lbs_private *priv)
 	priv->capability = WLAN_CAPABILITY_SHORT_PREAMBLE;
 	priv->psmode = LBS802_11POWERMODECAM;
 	priv->psstate = PS_STATE_FULL_POWER;
+	lbs_reset_snr_nf(priv);
 
 	mutex_init(&priv->lock);
 
@@ -1059,7 +1353,10 @@ static int lbs_init_adapter(struct lbs_private *priv)
 	INIT_LIST_HEAD(&priv->cmdpendingq);
 
 	spin_lock_init(&priv->driver_lock);
+	spin_lock_init(&priv->tx_lock);
+	lbs_tx_trace_init(priv);
 	init_waitqueue_head(&priv->cmd_pending);
+	seqlock_init(&priv->stats_lock);
 
 	/* Allocate the command buffers */
 	if (lbs_allocate_cmd_buffer(priv)) {
@@ -1070,6 +1367,17 @@ static int lbs_init_adapter(struct lbs_private *priv)
 	priv->resp_idx = 0;
 	priv->resp_len[0] = priv->resp_len[1] = 0;
 
+	/* Allocate the TX ring */
+	priv->tx_ring_size = min_t(unsigned int, max(lbs_tx_ring_depth, 1U),
+				   LBS_TX_RING_MAX_DEPTH);
+	priv->tx_ring = kzalloc(priv->tx_ring_size * sizeof(struct sk_buff *),
+				GFP_KERNEL);
+	if (!priv->tx_ring) {
+		lbs_pr_err("Out of memory allocating TX ring\n");
+		ret = -ENOMEM;
+		goto out;
+	}
+
 	/* Create the event FIFO */
 	priv->event_fifo = kfifo_alloc(sizeof(u32) * 16, GFP_KERNEL, NULL);
 	if (IS_ERR(priv->event_fifo)) {
@@ -1092,8 +1400,14 @@ static void lbs_free_adapter(struct lbs_private *priv)
 	if (priv->event_fifo)
 		kfifo_free(priv->event_fifo);
 	del_timer(&priv->command_timer);
+	if (priv->tx_ring)
+		lbs_tx_ring_flush(priv);
+	kfree(priv->tx_ring);
+	priv->tx_ring = NULL;
 	kfree(priv->networks);
 	priv->networks = NULL;
+	vfree(priv->scan_cache);
+	priv->scan_cache = NULL;
 
 	lbs_deb_leave(LBS_DEB_MAIN);
 }
@@ -1162,6 +1476,8 @@ struct lbs_private *lbs_add_card(void *card, struct device *dmdev)
 	INIT_DELAYED_WORK(&priv->scan_work, lbs_scan_worker);
 	INIT_WORK(&priv->mcast_work, lbs_set_mcast_worker);
 	INIT_WORK(&priv->sync_channel, lbs_sync_channel_worker);
+	INIT_DELAYED_WORK(&priv->stats_work, lbs_stats_worker);
+	INIT_DELAYED_WORK(&priv->hop_work, lbs_hop_worker);
 
 	sprintf(priv->mesh_ssid, "mesh");
 	priv->mesh_ssid_len = 4;
@@ -1197,6 +1513,8 @@ void lbs_remove_card(struct lbs_private *priv)
 
 	cancel_delayed_work_sync(&priv->scan_work);
 	cancel_delayed_work_sync(&priv->assoc_work);
+	cancel_delayed_work_sync(&priv->stats_work);
+	cancel_delayed_work_sync(&priv->hop_work);
 	cancel_work_sync(&priv->mcast_work);
 	destroy_workqueue(priv->work_thread);
 
@@ -1238,12 +1556,17 @@ int lbs_start_card(struct lbs_private *priv)
 	/* init 802.11d */
 	lbs_init_11d(priv);
 
+	/* room for the txpd and IF header to be built in place */
+	dev->needed_headroom = sizeof(struct txpd) + priv->hw_tx_headroom;
+
 	if (register_netdev(dev)) {
 		lbs_pr_err("cannot register ethX device\n");
 		goto done;
 	}
 	if (device_create_file(&dev->dev, &dev_attr_lbs_rtap))
 		lbs_pr_err("cannot register lbs_rtap attribute\n");
+	if (device_create_file(&dev->dev, &dev_attr_lbs_rtap_hop))
+		lbs_pr_err("cannot register lbs_rtap_hop attribute\n");
 
 	lbs_update_channel(priv);
 
@@ -1307,6 +1630,7 @@ void lbs_stop_card(struct lbs_private *priv)
 
 	lbs_debugfs_remove_one(priv);
 	device_remove_file(&dev->dev, &dev_attr_lbs_rtap);
+	device_remove_file(&dev->dev, &dev_attr_lbs_rtap_hop);
 	if (priv->mesh_tlv) {
 		device_remove_file(&dev->dev, &dev_attr_lbs_mesh);
 	}
@@ -1357,6 +1681,7 @@ static int lbs_add_mesh(struct lbs_private *priv)
 	mesh_dev->get_stats = lbs_get_stats;
 	mesh_dev->set_mac_address = lbs_set_mac_address;
 	mesh_dev->ethtool_ops = &lbs_ethtool_ops;
+	mesh_dev->needed_headroom = priv->dev->needed_headroom;
 	memcpy(mesh_dev->dev_addr, priv->dev->dev_addr,
 			sizeof(priv->dev->dev_addr));
 
@@ -1477,21 +1802,37 @@ out:
 	return ret;
 }
 
+/**
+ *  @brief Hands a firmware event to the main thread. The IF layer
+ *  calls this from a single context and lbs_thread() is the only
+ *  reader, so the fifo barriers are enough and driver_lock is only
+ *  needed to wake the card state up from sleep.
+ *
+ *  @param priv    A pointer to struct lbs_private structure
+ *  @param event   The event code
+ *  @return 	   n/a
+ */
 void lbs_queue_event(struct lbs_private *priv, u32 event)
 {
 	unsigned long flags;
 
 	lbs_deb_enter(LBS_DEB_THREAD);
-	spin_lock_irqsave(&priv->driver_lock, flags);
 
-	if (priv->psstate == PS_STATE_SLEEP)
-		priv->psstate = PS_STATE_AWAKE;
-
-	__kfifo_put(priv->event_fifo, (unsigned char *) &event, sizeof(u32));
+	if (!__kfifo_put(priv->event_fifo, (unsigned char *) &event,
+			 sizeof(u32)))
+		lbs_pr_err("event fifo full, dropping event 0x%x\n", event);
+
+	if (priv->psstate == PS_STATE_SLEEP) {
+		lbs_spin_lock_irqsave(&priv->driver_lock,
+				      &priv->driver_lock_stats, flags);
+		if (priv->psstate == PS_STATE_SLEEP)
+			priv->psstate = PS_STATE_AWAKE;
+		lbs_spin_unlock_irqrestore(&priv->driver_lock,
+					   &priv->driver_lock_stats, flags);
+	}
 
 	wake_up_interruptible(&priv->waitq);
 
-	spin_unlock_irqrestore(&priv->driver_lock, flags);
 	lbs_deb_leave(LBS_DEB_THREAD);
 }
 EXPORT_SYMBOL_GPL(lbs_queue_event);
@@ -1565,7 +1906,7 @@ static struct net_device_stats *lbs_rtap_get_stats(struct net_device *dev)
 {
 	struct lbs_private *priv = dev->priv;
 	lbs_deb_enter(LBS_DEB_NET);
-	return &priv->stats;
+	return &priv->rtap_stats;
 }
 
 
@@ -1607,6 +1948,12 @@ static int lbs_add_rtap(struct lbs_private *priv)
 	rtap_dev->priv = priv;
 	SET_NETDEV_DEV(rtap_dev, priv->dev->dev.parent);
 
+	memset(&priv->rtap_stats, 0, sizeof(priv->rtap_stats));
+	memset(priv->rtap_chan_stats, 0, sizeof(priv->rtap_chan_stats));
+	priv->rtap_rx_reallocs = 0;
+	priv->rtap_chan = 0;
+	priv->rtap_freq = 0;
+
 	ret = register_netdev(rtap_dev);
 	if (ret) {
 		free_netdev(rtap_dev);
@@ -46,6 +46,15 @@ struct rx_radiotap_hdr {
 #endif
 } __attribute__ ((packed));
 
+/*
+ * Headroom the IF layer adds in front of an upload in monitor mode, on
+ * top of what its own header leaves, so the radiotap header can be
+ * written where the rxpd was without reallocating the skb.
+ */
+#define LBS_RX_RTAP_HEADROOM						\
+	(sizeof(struct rx_radiotap_hdr) > sizeof(struct rxpd) ?		\
+	 sizeof(struct rx_radiotap_hdr) - sizeof(struct rxpd) : 0)
+
 #define RX_RADIOTAP_PRESENT (			\
 	(1 << IEEE80211_RADIOTAP_FLAGS) |	\
 	(1 << IEEE80211_RADIOTAP_RATE) |	\
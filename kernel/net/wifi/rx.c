@@ -44,16 +44,11 @@ static int process_rxed_802_11_packet(struct lbs_private *priv,
  *  @param priv    A pointer to struct lbs_private structure
  *  @return 	   avgSNR
  */
-static u8 lbs_getavgsnr(struct lbs_private *priv)
+static inline u8 lbs_getavgsnr(struct lbs_private *priv)
 {
-	u8 i;
-	u16 temp = 0;
 	if (priv->numSNRNF == 0)
 		return 0;
-	for (i = 0; i < priv->numSNRNF; i++)
-		temp += priv->rawSNR[i];
-	return (u8) (temp / priv->numSNRNF);
-
+	return (u8) (priv->sumSNR / priv->numSNRNF);
 }
 
 /**
@@ -62,34 +57,77 @@ static u8 lbs_getavgsnr(struct lbs_private *priv)
  *  @param priv    A pointer to struct lbs_private structure
  *  @return 	   AvgNF
  */
-static u8 lbs_getavgnf(struct lbs_private *priv)
+static inline u8 lbs_getavgnf(struct lbs_private *priv)
 {
-	u8 i;
-	u16 temp = 0;
 	if (priv->numSNRNF == 0)
 		return 0;
-	for (i = 0; i < priv->numSNRNF; i++)
-		temp += priv->rawNF[i];
-	return (u8) (temp / priv->numSNRNF);
+	return (u8) (priv->sumNF / priv->numSNRNF);
+}
 
+/**
+ *  @brief This function resets the SNR/NF averaging window and the
+ *  per-station extremes, e.g. on (re)association or disconnect
+ *
+ *  @param priv    A pointer to struct lbs_private structure
+ *  @return 	   n/a
+ */
+void lbs_reset_snr_nf(struct lbs_private *priv)
+{
+	memset(priv->rawSNR, 0x00, sizeof(priv->rawSNR));
+	memset(priv->rawNF, 0x00, sizeof(priv->rawNF));
+	priv->nextSNRNF = 0;
+	priv->numSNRNF = 0;
+	priv->sumSNR = 0;
+	priv->sumNF = 0;
+	priv->sqsumSNR = 0;
+	priv->sqsumNF = 0;
+	priv->minSNR = priv->minNF = 0xff;
+	priv->maxSNR = priv->maxNF = 0;
+	priv->samplesSNRNF = 0;
 }
 
 /**
  *  @brief This function save the raw SNR/NF to our internel buffer
  *
+ *  The running sums are updated as the oldest sample is evicted so the
+ *  averages don't need to walk the window on every packet.
+ *
  *  @param priv    A pointer to struct lbs_private structure
  *  @param prxpd   A pointer to rxpd structure of received packet
  *  @return 	   n/a
  */
 static void lbs_save_rawSNRNF(struct lbs_private *priv, struct rxpd *p_rx_pd)
 {
-	if (priv->numSNRNF < DEFAULT_DATA_AVG_FACTOR)
+	u8 snr = p_rx_pd->snr;
+	u8 nf = p_rx_pd->nf;
+	u8 old_snr = priv->rawSNR[priv->nextSNRNF];
+	u8 old_nf = priv->rawNF[priv->nextSNRNF];
+
+	if (priv->numSNRNF < DEFAULT_DATA_AVG_FACTOR) {
 		priv->numSNRNF++;
-	priv->rawSNR[priv->nextSNRNF] = p_rx_pd->snr;
-	priv->rawNF[priv->nextSNRNF] = p_rx_pd->nf;
+		old_snr = old_nf = 0;
+	}
+
+	priv->sumSNR += snr - old_snr;
+	priv->sumNF += nf - old_nf;
+	priv->sqsumSNR += snr * snr - old_snr * old_snr;
+	priv->sqsumNF += nf * nf - old_nf * old_nf;
+
+	priv->rawSNR[priv->nextSNRNF] = snr;
+	priv->rawNF[priv->nextSNRNF] = nf;
 	priv->nextSNRNF++;
 	if (priv->nextSNRNF >= DEFAULT_DATA_AVG_FACTOR)
 		priv->nextSNRNF = 0;
+
+	if (snr < priv->minSNR)
+		priv->minSNR = snr;
+	if (snr > priv->maxSNR)
+		priv->maxSNR = snr;
+	if (nf < priv->minNF)
+		priv->minNF = nf;
+	if (nf > priv->maxNF)
+		priv->maxNF = nf;
+	priv->samplesSNRNF++;
 	return;
 }
 
@@ -313,72 +351,94 @@ static int process_rxed_802_11_packet(struct lbs_private *priv,
 	int ret = 0;
 
 	struct rx80211packethdr *p_rx_pkt;
-	struct rxpd *prxpd;
-	struct rx_radiotap_hdr radiotap_hdr;
+	struct rxpd rxpd, *prxpd = &rxpd;
 	struct rx_radiotap_hdr *pradiotap_hdr;
+	struct lbs_rtap_chan_stats *chan_stats;
+	struct chan_freq_power *cfp;
+	u8 channel;
 
 	lbs_deb_enter(LBS_DEB_RX);
 
 	p_rx_pkt = (struct rx80211packethdr *) skb->data;
-	prxpd = &p_rx_pkt->rx_pd;
 
 	// lbs_deb_hex(LBS_DEB_RX, "RX Data: Before chop rxpd", skb->data, min(skb->len, 100));
 
 	if (skb->len < (ETH_HLEN + 8 + sizeof(struct rxpd))) {
 		lbs_deb_rx("rx err: frame received with bad length\n");
-		priv->stats.rx_length_errors++;
+		priv->rtap_stats.rx_length_errors++;
+		priv->rtap_stats.rx_dropped++;
 		ret = -EINVAL;
-		kfree(skb);
+		dev_kfree_skb_any(skb);
 		goto done;
 	}
 
+	/* The radiotap header overwrites the rxpd, so keep a copy */
+	rxpd = p_rx_pkt->rx_pd;
+
 	/*
 	 * Check rxpd status and update 802.3 stat,
 	 */
 	if (!(prxpd->status & cpu_to_le16(MRVDRV_RXPD_STATUS_OK))) {
 		//lbs_deb_rx("rx err: frame received with bad status\n");
-		priv->stats.rx_errors++;
+		priv->rtap_stats.rx_errors++;
 	}
 
 	lbs_deb_rx("rx data: skb->len-sizeof(RxPd) = %d-%zd = %zd\n",
 	       skb->len, sizeof(struct rxpd), skb->len - sizeof(struct rxpd));
 
-	/* create the exported radio header */
-
-	/* radiotap header */
-	radiotap_hdr.hdr.it_version = 0;
-	/* XXX must check this value for pad */
-	radiotap_hdr.hdr.it_pad = 0;
-	radiotap_hdr.hdr.it_len = cpu_to_le16 (sizeof(struct rx_radiotap_hdr));
-	radiotap_hdr.hdr.it_present = cpu_to_le32 (RX_RADIOTAP_PRESENT);
-	/* unknown values */
-	radiotap_hdr.flags = 0;
-	radiotap_hdr.chan_freq = 0;
-	radiotap_hdr.chan_flags = 0;
-	radiotap_hdr.antenna = 0;
-	/* known values */
-	radiotap_hdr.rate = convert_mv_rate_to_radiotap(prxpd->rx_rate);
-	/* XXX must check no carryout */
-	radiotap_hdr.antsignal = prxpd->snr + prxpd->nf;
-	radiotap_hdr.rx_flags = 0;
-	if (!(prxpd->status & cpu_to_le16(MRVDRV_RXPD_STATUS_OK)))
-		radiotap_hdr.rx_flags |= IEEE80211_RADIOTAP_F_RX_BADFCS;
-	//memset(radiotap_hdr.pad, 0x11, IEEE80211_RADIOTAP_HDRLEN - 18);
-
 	/* chop the rxpd */
 	skb_pull(skb, sizeof(struct rxpd));
 
-	/* add space for the new radio header */
-	if ((skb_headroom(skb) < sizeof(struct rx_radiotap_hdr)) &&
-	    pskb_expand_head(skb, sizeof(struct rx_radiotap_hdr), 0, GFP_ATOMIC)) {
-		lbs_pr_alert("%s: couldn't pskb_expand_head\n", __func__);
-		ret = -ENOMEM;
-		kfree_skb(skb);
-		goto done;
+	/*
+	 * The IF layer leaves LBS_RX_RTAP_HEADROOM in monitor mode, so
+	 * this only reallocates for a frame read before the switch.
+	 */
+	if (skb_headroom(skb) < sizeof(struct rx_radiotap_hdr)) {
+		if (pskb_expand_head(skb, sizeof(struct rx_radiotap_hdr), 0,
+				     GFP_ATOMIC)) {
+			lbs_pr_alert("%s: couldn't pskb_expand_head\n",
+				     __func__);
+			priv->rtap_stats.rx_dropped++;
+			ret = -ENOMEM;
+			dev_kfree_skb_any(skb);
+			goto done;
+		}
+		priv->rtap_rx_reallocs++;
 	}
 
+	/* create the exported radio header in place */
 	pradiotap_hdr = (void *)skb_push(skb, sizeof(struct rx_radiotap_hdr));
-	memcpy(pradiotap_hdr, &radiotap_hdr, sizeof(struct rx_radiotap_hdr));
+
+	pradiotap_hdr->hdr.it_version = 0;
+	/* XXX must check this value for pad */
+	pradiotap_hdr->hdr.it_pad = 0;
+	pradiotap_hdr->hdr.it_len = cpu_to_le16 (sizeof(struct rx_radiotap_hdr));
+	pradiotap_hdr->hdr.it_present = cpu_to_le32 (RX_RADIOTAP_PRESENT);
+	/* unknown values */
+	pradiotap_hdr->flags = 0;
+	pradiotap_hdr->antenna = 0;
+
+	/* The channel only changes on a hop or wext request, so the
+	   frequency is looked up again only then */
+	channel = priv->curbssparams.channel;
+	if (channel != priv->rtap_chan) {
+		cfp = lbs_find_cfp_by_band_and_channel(priv, 0, channel);
+		priv->rtap_chan = channel;
+		priv->rtap_freq = cfp ? cfp->freq : 0;
+	}
+	pradiotap_hdr->chan_freq = cpu_to_le16(priv->rtap_freq);
+	pradiotap_hdr->chan_flags = 0;
+	if (priv->rtap_freq)
+		pradiotap_hdr->chan_flags = cpu_to_le16(IEEE80211_CHAN_2GHZ |
+			(prxpd->rx_rate < 4 ? IEEE80211_CHAN_CCK :
+					      IEEE80211_CHAN_OFDM));
+	/* known values */
+	pradiotap_hdr->rate = convert_mv_rate_to_radiotap(prxpd->rx_rate);
+	/* XXX must check no carryout */
+	pradiotap_hdr->antsignal = prxpd->snr + prxpd->nf;
+	pradiotap_hdr->rx_flags = 0;
+	if (!(prxpd->status & cpu_to_le16(MRVDRV_RXPD_STATUS_OK)))
+		pradiotap_hdr->rx_flags |= IEEE80211_RADIOTAP_F_RX_BADFCS;
 
 	/* Take the data rate from the rxpd structure
 	 * only if the rate is auto
@@ -389,8 +449,13 @@ static int process_rxed_802_11_packet(struct lbs_private *priv,
 	lbs_compute_rssi(priv, prxpd);
 
 	lbs_deb_rx("rx data: size of actual packet %d\n", skb->len);
-	priv->stats.rx_bytes += skb->len;
-	priv->stats.rx_packets++;
+	priv->rtap_stats.rx_bytes += skb->len;
+	priv->rtap_stats.rx_packets++;
+
+	chan_stats = &priv->rtap_chan_stats[priv->rtap_freq &&
+		channel <= LBS_MONITOR_MAX_CHANNEL ? channel : 0];
+	chan_stats->frames++;
+	chan_stats->bytes += skb->len;
 
 	skb->protocol = eth_type_trans(skb, priv->rtap_net_dev);
 	netif_rx(skb);
@@ -5,6 +5,9 @@
   *  for sending scan commands to the firmware.
   */
 #include <linux/etherdevice.h>
+#include <linux/jhash.h>
+#include <linux/ktime.h>
+#include <linux/vmalloc.h>
 #include <asm/unaligned.h>
 
 #include "host.h"
@@ -35,6 +38,9 @@
 #define MAX_SCAN_CFG_ALLOC (sizeof(struct cmd_ds_802_11_scan)	\
                             + CHAN_TLV_MAX_SIZE + SSID_TLV_MAX_SIZE)
 
+//! Size of the WEXT scan output cache, the largest buffer iw_point can carry
+#define LBS_SCAN_CACHE_SIZE  0xffff
+
 //! The maximum number of channels the firmware can scan per command
 #define MRVDRV_MAX_CHANNELS_PER_SCAN   14
 
@@ -77,6 +83,30 @@ static void lbs_unset_basic_rate_flags(u8 *rates, size_t len)
 		rates[i] &= 0x7f;
 }
 
+/**
+ *  @brief Map a list of data rates onto the card rate table
+ *
+ *  @param rates     buffer of data rates, basic rate flags cleared
+ *  @param len       number of rates in the buffer
+ *
+ *  @return          bitmap with bit n set if lbs_bg_rates[n] is in rates
+ */
+static u16 lbs_rates_to_bitmap(const u8 *rates, size_t len)
+{
+	u16 bitmap = 0;
+	int i, j;
+
+	for (i = 0; i < len; i++) {
+		for (j = 0; j < MAX_RATES && lbs_bg_rates[j]; j++) {
+			if (rates[i] == lbs_bg_rates[j]) {
+				bitmap |= 1 << j;
+				break;
+			}
+		}
+	}
+	return bitmap;
+}
+
 
 static inline void clear_bss_descriptor(struct bss_descriptor *bss)
 {
@@ -113,6 +143,150 @@ static inline int is_same_network(struct bss_descriptor *src,
 		!memcmp(src->ssid, dst->ssid, src->ssid_len));
 }
 
+/**
+ *  @brief Return the BSSID hash bucket a BSS with this BSSID lives in
+ *
+ *  @param priv     A pointer to struct lbs_private
+ *  @param bssid    BSSID to hash
+ *
+ *  @return         Bucket head in priv->bss_bssid_hash
+ */
+struct hlist_head *lbs_bssid_bucket(struct lbs_private *priv,
+				    const u8 *bssid)
+{
+	u32 hash = jhash(bssid, ETH_ALEN, 0);
+
+	return &priv->bss_bssid_hash[hash & (LBS_BSS_HASH_SIZE - 1)];
+}
+
+/**
+ *  @brief Return the SSID hash bucket a BSS with this SSID lives in
+ *
+ *  @param priv     A pointer to struct lbs_private
+ *  @param ssid     SSID to hash
+ *  @param ssid_len Length of ssid
+ *
+ *  @return         Bucket head in priv->bss_ssid_hash
+ */
+struct hlist_head *lbs_ssid_bucket(struct lbs_private *priv,
+				   const u8 *ssid, u8 ssid_len)
+{
+	u32 hash = jhash(ssid, ssid_len, 0);
+
+	return &priv->bss_ssid_hash[hash & (LBS_BSS_HASH_SIZE - 1)];
+}
+
+/*
+ * Callers hold priv->lock for all of the index helpers below.  Indexing
+ * an entry also makes it the youngest on network_age_list; since
+ * last_scanned is stamped when the entry is (re)filled, the age list
+ * stays sorted by last_scanned and the oldest entry is always first.
+ */
+static void lbs_bss_index(struct lbs_private *priv, struct bss_descriptor *bss)
+{
+	priv->scan_gen++;
+	hlist_add_head(&bss->bssid_node, lbs_bssid_bucket(priv, bss->bssid));
+	hlist_add_head(&bss->ssid_node,
+		       lbs_ssid_bucket(priv, bss->ssid, bss->ssid_len));
+	list_add_tail(&bss->age_list, &priv->network_age_list);
+}
+
+static void lbs_bss_unindex(struct bss_descriptor *bss)
+{
+	if (!hlist_unhashed(&bss->bssid_node))
+		hlist_del_init(&bss->bssid_node);
+	if (!hlist_unhashed(&bss->ssid_node))
+		hlist_del_init(&bss->ssid_node);
+	list_del_init(&bss->age_list);
+}
+
+static void lbs_bss_free(struct lbs_private *priv, struct bss_descriptor *bss)
+{
+	priv->scan_gen++;
+	lbs_bss_unindex(bss);
+	list_move_tail(&bss->list, &priv->network_free_list);
+	clear_bss_descriptor(bss);
+}
+
+/**
+ *  @brief Drop scan table entries older than DEFAULT_MAX_SCAN_AGE
+ *
+ *  Only looks at the head of the age list, so the cost is proportional
+ *  to the number of entries actually expired.
+ *
+ *  @param priv     A pointer to struct lbs_private
+ *
+ *  @return         n/a
+ */
+static void lbs_bss_expire(struct lbs_private *priv)
+{
+	struct bss_descriptor *bss;
+
+	while (!list_empty(&priv->network_age_list)) {
+		bss = list_first_entry(&priv->network_age_list,
+				       struct bss_descriptor, age_list);
+		if (time_before(jiffies,
+				bss->last_scanned + DEFAULT_MAX_SCAN_AGE))
+			break;
+		lbs_bss_free(priv, bss);
+		priv->scan_merge.expired++;
+	}
+}
+
+/**
+ *  @brief Time hashed against linear scan table lookups
+ *
+ *  Looks every entry of the scan table up @rounds times, once through
+ *  the BSSID index and once by walking network_list, and accumulates
+ *  the elapsed time in priv->scan_lookup.
+ *
+ *  @param priv     A pointer to struct lbs_private
+ *  @param rounds   Number of passes over the table
+ *
+ *  @return         n/a
+ */
+void lbs_scan_lookup_bench(struct lbs_private *priv, unsigned int rounds)
+{
+	struct lbs_scan_lookup_stats *stats = &priv->scan_lookup;
+	struct bss_descriptor *bss, *iter_bss;
+	struct hlist_node *node;
+	ktime_t start;
+	unsigned int i, entries = 0;
+
+	mutex_lock(&priv->lock);
+	list_for_each_entry(bss, &priv->network_list, list)
+		entries++;
+
+	start = ktime_get();
+	for (i = 0; i < rounds; i++) {
+		list_for_each_entry(bss, &priv->network_list, list) {
+			hlist_for_each_entry(iter_bss, node,
+					lbs_bssid_bucket(priv, bss->bssid),
+					bssid_node) {
+				if (is_same_network(iter_bss, bss))
+					break;
+			}
+		}
+	}
+	stats->bench_hash_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	start = ktime_get();
+	for (i = 0; i < rounds; i++) {
+		list_for_each_entry(bss, &priv->network_list, list) {
+			list_for_each_entry(iter_bss, &priv->network_list,
+					    list) {
+				if (is_same_network(iter_bss, bss))
+					break;
+			}
+		}
+	}
+	stats->bench_list_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	stats->bench_rounds += rounds;
+	stats->bench_entries += rounds * entries;
+	mutex_unlock(&priv->lock);
+}
+
 
 
 
@@ -463,12 +637,12 @@ out2:
 out:
 	if (priv->connect_status == LBS_CONNECTED) {
 		netif_carrier_on(priv->dev);
-		if (!priv->tx_pending_len)
+		if (!lbs_tx_ring_full(priv))
 			netif_wake_queue(priv->dev);
 	}
 	if (priv->mesh_dev && (priv->mesh_connect_status == LBS_CONNECTED)) {
 		netif_carrier_on(priv->mesh_dev);
-		if (!priv->tx_pending_len)
+		if (!lbs_tx_ring_full(priv))
 			netif_wake_queue(priv->mesh_dev);
 	}
 	kfree(chan_list);
@@ -498,16 +672,21 @@ void lbs_scan_worker(struct work_struct *work)
  *  @brief Interpret a BSS scan response returned from the firmware
  *
  *  Parse the various fixed fields and IEs passed back for a a BSS probe
- *  response or beacon from the scan command.  Record information as needed
- *  in the scan table struct bss_descriptor for that entry.
+ *  response or beacon from the scan command in a single pass.  Record
+ *  information as needed in the scan table struct bss_descriptor for that
+ *  entry, along with the security class, rate bitmap and frequency the
+ *  association and WEXT paths would otherwise recompute per lookup.
  *
- *  @param bss  Output parameter: Pointer to the BSS Entry
+ *  @param priv A pointer to struct lbs_private structure
+ *  @param bss  Output parameter: Pointer to the cleared BSS Entry
  *
  *  @return             0 or -1
  */
-static int lbs_process_bss(struct bss_descriptor *bss,
+static int lbs_process_bss(struct lbs_private *priv,
+			   struct bss_descriptor *bss,
 			   uint8_t **pbeaconinfo, int *bytesleft)
 {
+	struct chan_freq_power *cfp;
 	struct ieeetypes_fhparamset *pFH;
 	struct ieeetypes_dsparamset *pDS;
 	struct ieeetypes_cfparamset *pCF;
@@ -575,8 +754,10 @@ static int lbs_process_bss(struct bss_descriptor *bss,
 	lbs_deb_scan("process_bss: capabilities 0x%04x\n", bss->capability);
 	pos += 2;
 
-	if (bss->capability & WLAN_CAPABILITY_PRIVACY)
+	if (bss->capability & WLAN_CAPABILITY_PRIVACY) {
+		bss->secclass |= LBS_BSS_SEC_PRIVACY;
 		lbs_deb_scan("process_bss: WEP enabled\n");
+	}
 	if (bss->capability & WLAN_CAPABILITY_IBSS)
 		bss->mode = IW_MODE_ADHOC;
 	else
@@ -684,6 +865,7 @@ static int lbs_process_bss(struct bss_descriptor *bss,
 			    elem->data[2] == 0xf2 && elem->data[3] == 0x01) {
 				bss->wpa_ie_len = min(elem->len + 2, MAX_WPA_IE_LEN);
 				memcpy(bss->wpa_ie, elem, bss->wpa_ie_len);
+				bss->secclass |= LBS_BSS_SEC_WPA;
 				lbs_deb_scan("got WPA IE\n");
 				lbs_deb_hex(LBS_DEB_SCAN, "WPA IE", bss->wpa_ie, elem->len);
 			} else if (elem->len >= MARVELL_MESH_IE_LENGTH &&
@@ -703,6 +885,7 @@ static int lbs_process_bss(struct bss_descriptor *bss,
 			lbs_deb_scan("got RSN IE\n");
 			bss->rsn_ie_len = min(elem->len + 2, MAX_WPA_IE_LEN);
 			memcpy(bss->rsn_ie, elem, bss->rsn_ie_len);
+			bss->secclass |= LBS_BSS_SEC_RSN;
 			lbs_deb_hex(LBS_DEB_SCAN, "process_bss: RSN_IE",
 				    bss->rsn_ie, elem->len);
 			break;
@@ -718,7 +901,13 @@ static int lbs_process_bss(struct bss_descriptor *bss,
 
 	/* Timestamp */
 	bss->last_scanned = jiffies;
-	lbs_unset_basic_rate_flags(bss->rates, sizeof(bss->rates));
+	bss->n_rates = min_t(uint8_t, n_basic_rates + n_ex_rates, MAX_RATES);
+	lbs_unset_basic_rate_flags(bss->rates, bss->n_rates);
+	bss->rate_bitmap = lbs_rates_to_bitmap(bss->rates, bss->n_rates);
+
+	cfp = lbs_find_cfp_by_band_and_channel(priv, 0, bss->channel);
+	if (cfp)
+		bss->freq = cfp->freq;
 
 	ret = 0;
 
@@ -780,10 +969,9 @@ static inline char *lbs_translate_scan(struct lbs_private *priv,
 					    char *start, char *stop,
 					    struct bss_descriptor *bss)
 {
-	struct chan_freq_power *cfp;
 	char *current_val;	/* For rates */
 	struct iw_event iwe;	/* Temporary buffer */
-	int j;
+	int j, own_ssid;
 #define PERFECT_RSSI ((uint8_t)50)
 #define WORST_RSSI   ((uint8_t)0)
 #define RSSI_DIFF    ((uint8_t)(PERFECT_RSSI - WORST_RSSI))
@@ -791,13 +979,18 @@ static inline char *lbs_translate_scan(struct lbs_private *priv,
 
 	lbs_deb_enter(LBS_DEB_SCAN);
 
-	cfp = lbs_find_cfp_by_band_and_channel(priv, 0, bss->channel);
-	if (!cfp) {
+	if (!bss->freq) {
 		lbs_deb_scan("Invalid channel number %d\n", bss->channel);
 		start = NULL;
 		goto out;
 	}
 
+	/* Matches the ad-hoc BSS we created ourselves */
+	own_ssid = priv->adhoccreate &&
+		!lbs_ssid_cmp(priv->curbssparams.ssid,
+			      priv->curbssparams.ssid_len,
+			      bss->ssid, bss->ssid_len);
+
 	/* First entry *MUST* be the BSSID */
 	iwe.cmd = SIOCGIWAP;
 	iwe.u.ap_addr.sa_family = ARPHRD_ETHER;
@@ -817,7 +1010,7 @@ static inline char *lbs_translate_scan(struct lbs_private *priv,
 
 	/* Frequency */
 	iwe.cmd = SIOCGIWFREQ;
-	iwe.u.freq.m = (long)cfp->freq * 100000;
+	iwe.u.freq.m = (long)bss->freq * 100000;
 	iwe.u.freq.e = 1;
 	start = iwe_stream_add_event(info, start, stop, &iwe, IW_EV_FREQ_LEN);
 
@@ -844,10 +1037,7 @@ static inline char *lbs_translate_scan(struct lbs_private *priv,
 	 * only station in the adhoc network; so get signal strength
 	 * from receive statistics.
 	 */
-	if ((priv->mode == IW_MODE_ADHOC) && priv->adhoccreate
-	    && !lbs_ssid_cmp(priv->curbssparams.ssid,
-			     priv->curbssparams.ssid_len,
-			     bss->ssid, bss->ssid_len)) {
+	if ((priv->mode == IW_MODE_ADHOC) && own_ssid) {
 		int snr, nf;
 		snr = priv->SNR[TYPE_RXPD][TYPE_AVG] / AVG_SCALE;
 		nf = priv->NF[TYPE_RXPD][TYPE_AVG] / AVG_SCALE;
@@ -857,7 +1047,7 @@ static inline char *lbs_translate_scan(struct lbs_private *priv,
 
 	/* Add encryption capability */
 	iwe.cmd = SIOCGIWENCODE;
-	if (bss->capability & WLAN_CAPABILITY_PRIVACY) {
+	if (bss->secclass & LBS_BSS_SEC_PRIVACY) {
 		iwe.u.data.flags = IW_ENCODE_ENABLED | IW_ENCODE_NOKEY;
 	} else {
 		iwe.u.data.flags = IW_ENCODE_DISABLED;
@@ -872,16 +1062,13 @@ static inline char *lbs_translate_scan(struct lbs_private *priv,
 	iwe.u.bitrate.disabled = 0;
 	iwe.u.bitrate.value = 0;
 
-	for (j = 0; bss->rates[j] && (j < sizeof(bss->rates)); j++) {
+	for (j = 0; j < bss->n_rates; j++) {
 		/* Bit rate given in 500 kb/s units */
 		iwe.u.bitrate.value = bss->rates[j] * 500000;
 		current_val = iwe_stream_add_value(info, start, current_val,
 						   stop, &iwe, IW_EV_PARAM_LEN);
 	}
-	if ((bss->mode == IW_MODE_ADHOC) && priv->adhoccreate
-	    && !lbs_ssid_cmp(priv->curbssparams.ssid,
-			     priv->curbssparams.ssid_len,
-			     bss->ssid, bss->ssid_len)) {
+	if ((bss->mode == IW_MODE_ADHOC) && own_ssid) {
 		iwe.u.bitrate.value = 22 * 500000;
 		current_val = iwe_stream_add_value(info, start, current_val,
 						   stop, &iwe, IW_EV_PARAM_LEN);
@@ -892,20 +1079,18 @@ static inline char *lbs_translate_scan(struct lbs_private *priv,
 
 	memset(&iwe, 0, sizeof(iwe));
 	if (bss->wpa_ie_len) {
-		char buf[MAX_WPA_IE_LEN];
-		memcpy(buf, bss->wpa_ie, bss->wpa_ie_len);
 		iwe.cmd = IWEVGENIE;
 		iwe.u.data.length = bss->wpa_ie_len;
-		start = iwe_stream_add_point(info, start, stop, &iwe, buf);
+		start = iwe_stream_add_point(info, start, stop, &iwe,
+					     (char *)bss->wpa_ie);
 	}
 
 	memset(&iwe, 0, sizeof(iwe));
 	if (bss->rsn_ie_len) {
-		char buf[MAX_WPA_IE_LEN];
-		memcpy(buf, bss->rsn_ie, bss->rsn_ie_len);
 		iwe.cmd = IWEVGENIE;
 		iwe.u.data.length = bss->rsn_ie_len;
-		start = iwe_stream_add_point(info, start, stop, &iwe, buf);
+		start = iwe_stream_add_point(info, start, stop, &iwe,
+					     (char *)bss->rsn_ie);
 	}
 
 	if (bss->mesh) {
@@ -983,9 +1168,79 @@ out:
 }
 
 
+#define SCAN_ITEM_SIZE 128
+
+/**
+ *  @brief Translate more of the scan table into the WEXT output cache
+ *
+ *  The cache holds the WEXT stream of one scan table generation, as read
+ *  from one device, up to the end of the last entry translated.  Its
+ *  cursor (scan_cache_gen plus scan_cache_pos) lets a retry with a larger
+ *  buffer carry on where the previous call stopped rather than translate
+ *  the whole table again.  Caller holds priv->lock.
+ *
+ *  @param priv         A pointer to struct lbs_private structure
+ *  @param dev          A pointer to the net_device the table is read from
+ *  @param info         A pointer to iw_request_info structure
+ *  @param want         Stop once more than this many bytes are cached
+ *
+ *  @return             0, or -E2BIG if the table doesn't fit in the cache
+ */
+static int lbs_scan_cache_fill(struct lbs_private *priv,
+			       struct net_device *dev,
+			       struct iw_request_info *info, size_t want)
+{
+	char *stop = priv->scan_cache + LBS_SCAN_CACHE_SIZE;
+	struct bss_descriptor *iter_bss;
+
+	/* Signal of our own ad-hoc BSS is refreshed on every read */
+	if (priv->scan_cache_gen != priv->scan_gen ||
+	    priv->scan_cache_dev != dev ||
+	    priv->scan_cache_flags != info->flags ||
+	    priv->adhoccreate) {
+		priv->scan_cache_gen = priv->scan_gen;
+		priv->scan_cache_dev = dev;
+		priv->scan_cache_flags = info->flags;
+		priv->scan_cache_pos = &priv->network_list;
+		priv->scan_cache_len = 0;
+		priv->scan_cache_done = 0;
+	}
+
+	iter_bss = list_entry(priv->scan_cache_pos, struct bss_descriptor,
+			      list);
+	list_for_each_entry_continue(iter_bss, &priv->network_list, list) {
+		char *ev = priv->scan_cache + priv->scan_cache_len;
+		char *next_ev;
+
+		if (priv->scan_cache_len > want)
+			return 0;
+		if (stop - ev < SCAN_ITEM_SIZE)
+			return -E2BIG;
+		priv->scan_cache_pos = &iter_bss->list;
+
+		/* For mesh device, list only mesh networks */
+		if (dev == priv->mesh_dev && !iter_bss->mesh)
+			continue;
+
+		/* Translate to WE format this entry */
+		next_ev = lbs_translate_scan(priv, info, ev, stop, iter_bss);
+		if (next_ev == NULL)
+			continue;
+		priv->scan_cache_len = next_ev - priv->scan_cache;
+	}
+
+	priv->scan_cache_done = 1;
+	return 0;
+}
+
 /**
  *  @brief  Handle Retrieve scan table ioctl
  *
+ *  Entries are translated once per scan table generation into a cache,
+ *  so a caller retrying after -E2BIG only pays for the entries the
+ *  smaller buffer didn't reach.  While a chunked scan is running the
+ *  table is returned as soon as its first chunk has been merged.
+ *
  *  @param dev          A pointer to net_device structure
  *  @param info         A pointer to iw_request_info structure
  *  @param dwrq         A pointer to iw_point structure
@@ -996,18 +1251,13 @@ out:
 int lbs_get_scan(struct net_device *dev, struct iw_request_info *info,
 		 struct iw_point *dwrq, char *extra)
 {
-#define SCAN_ITEM_SIZE 128
 	struct lbs_private *priv = dev->priv;
 	int err = 0;
-	char *ev = extra;
-	char *stop = ev + dwrq->length;
-	struct bss_descriptor *iter_bss;
-	struct bss_descriptor *safe;
 
 	lbs_deb_enter(LBS_DEB_WEXT);
 
-	/* iwlist should wait until the current scan is finished */
-	if (priv->scan_channel)
+	/* iwlist should wait until the first part of the scan is in */
+	if (priv->scan_channel < 0)
 		return -EAGAIN;
 
 	/* Update RSSI if current BSS is a locally created ad-hoc BSS */
@@ -1016,38 +1266,34 @@ int lbs_get_scan(struct net_device *dev, struct iw_request_info *info,
 					     CMD_OPTION_WAITFORRSP, 0, NULL);
 
 	mutex_lock(&priv->lock);
-	list_for_each_entry_safe (iter_bss, safe, &priv->network_list, list) {
-		char *next_ev;
-		unsigned long stale_time;
-
-		if (stop - ev < SCAN_ITEM_SIZE) {
-			err = -E2BIG;
-			break;
-		}
-
-		/* For mesh device, list only mesh networks */
-		if (dev == priv->mesh_dev && !iter_bss->mesh)
-			continue;
-
-		/* Prune old an old scan result */
-		stale_time = iter_bss->last_scanned + DEFAULT_MAX_SCAN_AGE;
-		if (time_after(jiffies, stale_time)) {
-			list_move_tail(&iter_bss->list, &priv->network_free_list);
-			clear_bss_descriptor(iter_bss);
-			continue;
+	/* Prune old scan results */
+	lbs_bss_expire(priv);
+
+	if (!priv->scan_cache) {
+		priv->scan_cache = vmalloc(LBS_SCAN_CACHE_SIZE);
+		if (!priv->scan_cache) {
+			err = -ENOMEM;
+			goto out_unlock;
 		}
-
-		/* Translate to WE format this entry */
-		next_ev = lbs_translate_scan(priv, info, ev, stop, iter_bss);
-		if (next_ev == NULL)
-			continue;
-		ev = next_ev;
 	}
-	mutex_unlock(&priv->lock);
 
-	dwrq->length = (ev - extra);
+	err = lbs_scan_cache_fill(priv, dev, info, dwrq->length);
+	if (!err && (!priv->scan_cache_done ||
+		     priv->scan_cache_len > dwrq->length))
+		err = -E2BIG;
+
+	if (!err) {
+		memcpy(extra, priv->scan_cache, priv->scan_cache_len);
+		dwrq->length = priv->scan_cache_len;
+	} else if (err == -E2BIG && priv->scan_cache_done) {
+		/* Let the caller know how much room it needs */
+		dwrq->length = priv->scan_cache_len;
+	}
 	dwrq->flags = 0;
 
+out_unlock:
+	mutex_unlock(&priv->lock);
+
 	lbs_deb_leave_args(LBS_DEB_WEXT, "ret %d", err);
 	return err;
 }
@@ -1093,24 +1339,18 @@ static int lbs_ret_80211_scan(struct lbs_private *priv, unsigned long dummy,
 {
 	struct cmd_ds_802_11_scan_rsp *scanresp = (void *)resp;
 	struct bss_descriptor *iter_bss;
-	struct bss_descriptor *safe;
 	uint8_t *bssinfo;
 	uint16_t scanrespsize;
 	int bytesleft;
 	int idx;
 	int tlvbufsize;
 	int ret;
+	ktime_t start = ktime_get();
 
 	lbs_deb_enter(LBS_DEB_SCAN);
 
 	/* Prune old entries from scan table */
-	list_for_each_entry_safe (iter_bss, safe, &priv->network_list, list) {
-		unsigned long stale_time = iter_bss->last_scanned + DEFAULT_MAX_SCAN_AGE;
-		if (time_before(jiffies, stale_time))
-			continue;
-		list_move_tail (&iter_bss->list, &priv->network_free_list);
-		clear_bss_descriptor(iter_bss);
-	}
+	lbs_bss_expire(priv);
 
 	if (scanresp->nr_sets > MAX_NETWORK_COUNT) {
 		lbs_deb_scan("SCAN_RESP: too many scan results (%d, max %d)\n",
@@ -1137,60 +1377,68 @@ static int lbs_ret_80211_scan(struct lbs_private *priv, unsigned long dummy,
 				     + S_DS_GEN);
 
 	/*
-	 *  Process each scan response returned (scanresp->nr_sets). Save
-	 *    the information in the newbssentry and then insert into the
-	 *    driver scan table either as an update to an existing entry
-	 *    or as an addition at the end of the table
+	 *  Process each scan response returned (scanresp->nr_sets). Each BSS
+	 *    is parsed straight into the spare slot at the head of the free
+	 *    list, which then either takes the place of the entry it updates
+	 *    or is added at the end of the table
 	 */
 	for (idx = 0; idx < scanresp->nr_sets && bytesleft; idx++) {
-		struct bss_descriptor new;
+		struct bss_descriptor *new;
 		struct bss_descriptor *found = NULL;
-		struct bss_descriptor *oldest = NULL;
+		struct hlist_node *node;
 		DECLARE_MAC_BUF(mac);
 
+		new = list_first_entry(&priv->network_free_list,
+				       struct bss_descriptor, list);
+
 		/* Process the data fields and IEs returned for this BSS */
-		memset(&new, 0, sizeof (struct bss_descriptor));
-		if (lbs_process_bss(&new, &bssinfo, &bytesleft) != 0) {
+		if (lbs_process_bss(priv, new, &bssinfo, &bytesleft) != 0) {
 			/* error parsing the scan response, skipped */
 			lbs_deb_scan("SCAN_RESP: process_bss returned ERROR\n");
+			clear_bss_descriptor(new);
 			continue;
 		}
 
 		/* Try to find this bss in the scan table */
-		list_for_each_entry (iter_bss, &priv->network_list, list) {
-			if (is_same_network(iter_bss, &new)) {
+		priv->scan_lookup.merge_lookups++;
+		hlist_for_each_entry(iter_bss, node,
+				     lbs_bssid_bucket(priv, new->bssid),
+				     bssid_node) {
+			priv->scan_lookup.steps++;
+			if (is_same_network(iter_bss, new)) {
 				found = iter_bss;
 				break;
 			}
-
-			if ((oldest == NULL) ||
-			    (iter_bss->last_scanned < oldest->last_scanned))
-				oldest = iter_bss;
 		}
 
 		if (found) {
-			/* found, clear it */
+			/* found, the new entry takes its place in the table */
+			lbs_bss_unindex(found);
+			list_replace(&found->list, &new->list);
+			list_add_tail(&found->list, &priv->network_free_list);
 			clear_bss_descriptor(found);
-		} else if (!list_empty(&priv->network_free_list)) {
-			/* Pull one from the free list */
-			found = list_entry(priv->network_free_list.next,
-					   struct bss_descriptor, list);
-			list_move_tail(&found->list, &priv->network_list);
-		} else if (oldest) {
-			/* If there are no more slots, expire the oldest */
-			found = oldest;
-			clear_bss_descriptor(found);
-			list_move_tail(&found->list, &priv->network_list);
+			priv->scan_merge.updated++;
 		} else {
-			continue;
+			list_move_tail(&new->list, &priv->network_list);
+			priv->scan_merge.added++;
 		}
 
-		lbs_deb_scan("SCAN_RESP: BSSID %s\n", print_mac(mac, new.bssid));
-
-		/* Copy the locally created newbssentry to the scan table */
-		memcpy(found, &new, offsetof(struct bss_descriptor, list));
+		lbs_deb_scan("SCAN_RESP: BSSID %s\n",
+			     print_mac(mac, new->bssid));
+		lbs_bss_index(priv, new);
+
+		/* Table full: expire the oldest to keep a spare slot */
+		if (list_empty(&priv->network_free_list)) {
+			iter_bss = list_first_entry(&priv->network_age_list,
+						    struct bss_descriptor,
+						    age_list);
+			lbs_bss_free(priv, iter_bss);
+			priv->scan_merge.evicted++;
+		}
 	}
 
+	priv->scan_merge.chunks++;
+	lbs_hist_add(&priv->scan_merge.time, lbs_usecs_since(start));
 	ret = 0;
 
 done:
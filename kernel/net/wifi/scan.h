@@ -14,6 +14,12 @@
 
 int lbs_ssid_cmp(u8 *ssid1, u8 ssid1_len, u8 *ssid2, u8 ssid2_len);
 
+struct hlist_head *lbs_bssid_bucket(struct lbs_private *priv,
+				    const u8 *bssid);
+struct hlist_head *lbs_ssid_bucket(struct lbs_private *priv,
+				   const u8 *ssid, u8 ssid_len);
+void lbs_scan_lookup_bench(struct lbs_private *priv, unsigned int rounds);
+
 int lbs_send_specific_ssid_scan(struct lbs_private *priv, u8 *ssid,
 				u8 ssid_len);
 
@@ -50,8 +50,9 @@ static u32 convert_radiotap_rate_to_mv(u8 rate)
 }
 
 /**
- *  @brief This function checks the conditions and sends packet to IF
- *  layer if everything is ok.
+ *  @brief This function checks the conditions and lines the packet up
+ *  for the IF layer if everything is ok. The txpd is written into the
+ *  skb headroom, so on the fast path the payload is never copied.
  *
  *  @param priv    A pointer to struct lbs_private structure
  *  @param skb     A pointer to skb which includes TX packet
@@ -61,9 +62,12 @@ int lbs_hard_start_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	unsigned long flags;
 	struct lbs_private *priv = dev->priv;
+	struct sk_buff *txskb;
 	struct txpd *txpd;
 	char *p802x_hdr;
 	uint16_t pkt_len;
+	u32 tx_control = 0;
+	unsigned int headroom;
 	int ret;
 
 	lbs_deb_enter(LBS_DEB_TX);
@@ -71,8 +75,9 @@ int lbs_hard_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	ret = NETDEV_TX_OK;
 
 	/* We need to protect against the queues being restarted before
-	   we get round to stopping them */
-	spin_lock_irqsave(&priv->driver_lock, flags);
+	   we get round to stopping them. Only the TX state is touched
+	   here, so commands and events don't hold us up. */
+	lbs_spin_lock_irqsave(&priv->tx_lock, &priv->tx_lock_stats, flags);
 
 	if (priv->surpriseremoved)
 		goto free;
@@ -87,67 +92,95 @@ int lbs_hard_start_xmit(struct sk_buff *skb, struct net_device *dev)
 		goto free;
 	}
 
-
-	netif_stop_queue(priv->dev);
-	if (priv->mesh_dev)
-		netif_stop_queue(priv->mesh_dev);
-
-	if (priv->tx_pending_len) {
+	if (lbs_tx_ring_full(priv)) {
 		/* This can happen if packets come in on the mesh and eth
 		   device simultaneously -- there's no mutual exclusion on
 		   hard_start_xmit() calls between devices. */
 		lbs_deb_tx("Packet on %s while busy\n", dev->name);
+		netif_stop_queue(priv->dev);
+		if (priv->mesh_dev)
+			netif_stop_queue(priv->mesh_dev);
+		lbs_tx_trace_stop(priv);
 		ret = NETDEV_TX_BUSY;
 		goto unlock;
 	}
 
-	priv->tx_pending_len = -1;
-	spin_unlock_irqrestore(&priv->driver_lock, flags);
-
 	lbs_deb_hex(LBS_DEB_TX, "TX Data", skb->data, min_t(unsigned int, skb->len, 100));
 
-	txpd = (void *)priv->tx_pending_buf;
-	memset(txpd, 0, sizeof(struct txpd));
+	headroom = sizeof(struct txpd) + priv->hw_tx_headroom;
 
-	p802x_hdr = skb->data;
-	pkt_len = skb->len;
+	if (priv->monitormode) {
+		/* The skb is echoed back with its radiotap header once
+		   TX feedback arrives, so the card gets a copy */
+		txskb = skb_copy_expand(skb, headroom, 0, GFP_ATOMIC);
+		if (!txskb)
+			goto drop;
+		priv->tx_copy_monitor++;
+	} else if (skb_headroom(skb) < headroom || skb_header_cloned(skb)) {
+		int delta = max_t(int, headroom - skb_headroom(skb), 0);
+
+		lbs_deb_tx("reallocating skb headroom (%d < %d)\n",
+			skb_headroom(skb), headroom);
+		if (pskb_expand_head(skb, delta, 0, GFP_ATOMIC))
+			goto drop;
+		priv->tx_copy_headroom++;
+		txskb = skb;
+	} else {
+		priv->tx_nocopy++;
+		txskb = skb;
+	}
+
+	p802x_hdr = txskb->data;
 
 	if (dev == priv->rtap_net_dev) {
-		struct tx_radiotap_hdr *rtap_hdr = (void *)skb->data;
+		struct tx_radiotap_hdr *rtap_hdr = (void *)txskb->data;
 
 		/* set txpd fields from the radiotap header */
-		txpd->tx_control = cpu_to_le32(convert_radiotap_rate_to_mv(rtap_hdr->rate));
+		tx_control = convert_radiotap_rate_to_mv(rtap_hdr->rate);
 
 		/* skip the radiotap header */
-		p802x_hdr += sizeof(*rtap_hdr);
-		pkt_len -= sizeof(*rtap_hdr);
+		p802x_hdr = skb_pull(txskb, sizeof(*rtap_hdr));
 
-		/* copy destination address from 802.11 header */
-		memcpy(txpd->tx_dest_addr_high, p802x_hdr + 4, ETH_ALEN);
-	} else {
-		/* copy destination address from 802.3 header */
-		memcpy(txpd->tx_dest_addr_high, p802x_hdr, ETH_ALEN);
+		/* destination address is in the 802.11 header */
+		p802x_hdr += 4;
 	}
 
+	pkt_len = txskb->len;
+
+	txpd = (struct txpd *) skb_push(txskb, sizeof(struct txpd));
+	memset(txpd, 0, sizeof(struct txpd));
+
+	txpd->tx_control = cpu_to_le32(tx_control);
+	memcpy(txpd->tx_dest_addr_high, p802x_hdr, ETH_ALEN);
+
 	txpd->tx_packet_length = cpu_to_le16(pkt_len);
 	txpd->tx_packet_location = cpu_to_le32(sizeof(struct txpd));
 
 	if (dev == priv->mesh_dev)
 		txpd->tx_control |= cpu_to_le32(TxPD_MESH_FRAME);
 
-	lbs_deb_hex(LBS_DEB_TX, "txpd", (u8 *) &txpd, sizeof(struct txpd));
+	lbs_deb_hex(LBS_DEB_TX, "txpd", (u8 *) txpd, sizeof(struct txpd));
 
-	lbs_deb_hex(LBS_DEB_TX, "Tx Data", (u8 *) p802x_hdr, le16_to_cpu(txpd->tx_packet_length));
+	lbs_tx_trace_start(priv, txskb);
 
-	memcpy(&txpd[1], p802x_hdr, le16_to_cpu(txpd->tx_packet_length));
+	priv->tx_ring[priv->tx_ring_head] = txskb;
+	priv->tx_ring_head = (priv->tx_ring_head + 1) % priv->tx_ring_size;
+	priv->tx_ring_count++;
 
-	spin_lock_irqsave(&priv->driver_lock, flags);
-	priv->tx_pending_len = pkt_len + sizeof(struct txpd);
+	/* In monitor mode only one packet at a time may wait for its
+	   TX feedback, so keep the queues stopped until it arrives */
+	if (lbs_tx_ring_full(priv) || priv->monitormode) {
+		netif_stop_queue(priv->dev);
+		if (priv->mesh_dev)
+			netif_stop_queue(priv->mesh_dev);
+		lbs_tx_trace_stop(priv);
+	}
 
-	lbs_deb_tx("%s lined up packet\n", __func__);
+	lbs_deb_tx("%s lined up packet, %d in ring\n", __func__,
+		priv->tx_ring_count);
 
 	priv->stats.tx_packets++;
-	priv->stats.tx_bytes += skb->len;
+	priv->stats.tx_bytes += pkt_len;
 
 	dev->trans_start = jiffies;
 
@@ -158,18 +191,90 @@ int lbs_hard_start_xmit(struct sk_buff *skb, struct net_device *dev)
 
 		/* Keep the skb around for when we get feedback */
 		priv->currenttxskb = skb;
-	} else {
- free:
-		dev_kfree_skb_any(skb);
 	}
+	goto unlock;
+
+ drop:
+	priv->stats.tx_dropped++;
+ free:
+	dev_kfree_skb_any(skb);
  unlock:
-	spin_unlock_irqrestore(&priv->driver_lock, flags);
+	lbs_spin_unlock_irqrestore(&priv->tx_lock, &priv->tx_lock_stats, flags);
 	wake_up(&priv->waitq);
 
 	lbs_deb_leave_args(LBS_DEB_TX, "ret %d", ret);
 	return ret;
 }
 
+/**
+ *  @brief This function hands the oldest packet of the TX ring to the
+ *  IF layer. Called by the main thread with driver_lock held once the
+ *  card can accept a data packet; tx_lock is only held for the pop.
+ *
+ *  @param priv    A pointer to struct lbs_private structure
+ *  @return 	   0 or error code from the IF layer
+ */
+int lbs_tx_ring_send(struct lbs_private *priv)
+{
+	struct sk_buff *skb;
+	u32 seq;
+	int ret;
+
+	lbs_spin_lock(&priv->tx_lock, &priv->tx_lock_stats);
+	skb = priv->tx_ring[priv->tx_ring_tail];
+	priv->tx_ring[priv->tx_ring_tail] = NULL;
+	priv->tx_ring_tail = (priv->tx_ring_tail + 1) % priv->tx_ring_size;
+	priv->tx_ring_count--;
+	lbs_spin_unlock(&priv->tx_lock, &priv->tx_lock_stats);
+
+	seq = lbs_tx_trace_seq(skb);
+	lbs_tx_trace_stamp(priv, seq, seq, LBS_TX_STAGE_DEQUEUE);
+
+	/* consumed even on error, so it isn't freed here */
+	if (priv->hw_host_to_card_skb)
+		return priv->hw_host_to_card_skb(priv, skb);
+
+	/* The IF layer only takes flat buffers, which it copies */
+	priv->tx_copy_iface++;
+	ret = priv->hw_host_to_card(priv, MVMS_DAT, skb->data, skb->len);
+	dev_kfree_skb_any(skb);
+	if (!ret)
+		lbs_tx_trace_stamp(priv, seq, seq, LBS_TX_STAGE_WRITTEN);
+
+	return ret;
+}
+
+/**
+ *  @brief This function drops the packets still waiting in the TX
+ *  ring and the one kept for TX feedback, e.g. after the link has
+ *  been lost.
+ *
+ *  @param priv    A pointer to struct lbs_private structure
+ *  @return 	   n/a
+ */
+void lbs_tx_ring_flush(struct lbs_private *priv)
+{
+	unsigned long flags;
+
+	lbs_deb_enter(LBS_DEB_TX);
+
+	lbs_spin_lock_irqsave(&priv->tx_lock, &priv->tx_lock_stats, flags);
+	if (priv->currenttxskb) {
+		dev_kfree_skb_any(priv->currenttxskb);
+		priv->currenttxskb = NULL;
+	}
+	while (lbs_tx_ring_ready(priv)) {
+		dev_kfree_skb_any(priv->tx_ring[priv->tx_ring_tail]);
+		priv->tx_ring[priv->tx_ring_tail] = NULL;
+		priv->tx_ring_tail = (priv->tx_ring_tail + 1) % priv->tx_ring_size;
+		priv->tx_ring_count--;
+		priv->stats.tx_dropped++;
+	}
+	lbs_spin_unlock_irqrestore(&priv->tx_lock, &priv->tx_lock_stats, flags);
+
+	lbs_deb_leave(LBS_DEB_TX);
+}
+
 /**
  *  @brief This function sends to the host the last transmitted packet,
  *  filling the radiotap headers with transmission information.
@@ -182,20 +287,29 @@ int lbs_hard_start_xmit(struct sk_buff *skb, struct net_device *dev)
 void lbs_send_tx_feedback(struct lbs_private *priv, u32 try_count)
 {
 	struct tx_radiotap_hdr *radiotap_hdr;
+	struct sk_buff *skb;
+	unsigned long flags;
+
+	if (!priv->monitormode)
+		return;
+
+	lbs_spin_lock_irqsave(&priv->tx_lock, &priv->tx_lock_stats, flags);
+	skb = priv->currenttxskb;
+	priv->currenttxskb = NULL;
+	lbs_spin_unlock_irqrestore(&priv->tx_lock, &priv->tx_lock_stats, flags);
 
-	if (!priv->monitormode || priv->currenttxskb == NULL)
+	if (!skb)
 		return;
 
-	radiotap_hdr = (struct tx_radiotap_hdr *)priv->currenttxskb->data;
+	radiotap_hdr = (struct tx_radiotap_hdr *)skb->data;
 
 	radiotap_hdr->data_retries = try_count ?
 		(1 + priv->txretrycount - try_count) : 0;
 
-	priv->currenttxskb->protocol = eth_type_trans(priv->currenttxskb,
-						      priv->rtap_net_dev);
-	netif_rx(priv->currenttxskb);
+	skb->protocol = eth_type_trans(skb, priv->rtap_net_dev);
+	netif_rx(skb);
 
-	priv->currenttxskb = NULL;
+	lbs_tx_trace_wake(priv);
 
 	if (priv->connect_status == LBS_CONNECTED)
 		netif_wake_queue(priv->dev);
@@ -204,3 +318,139 @@ void lbs_send_tx_feedback(struct lbs_private *priv, u32 try_count)
 		netif_wake_queue(priv->mesh_dev);
 }
 EXPORT_SYMBOL_GPL(lbs_send_tx_feedback);
+
+#ifdef LBS_TX_TRACE
+/**
+ *  @brief This function resets the TX latency trace.
+ *
+ *  @param priv    A pointer to struct lbs_private structure
+ *  @return 	   n/a
+ */
+void lbs_tx_trace_init(struct lbs_private *priv)
+{
+	memset(&priv->tx_trace, 0, sizeof(priv->tx_trace));
+	spin_lock_init(&priv->tx_trace.lock);
+}
+
+/**
+ *  @brief This function gives a frame lined up for TX the next trace
+ *  sequence number and records its XMIT stage.
+ *
+ *  @param priv    A pointer to struct lbs_private structure
+ *  @param skb     The frame, with its txpd already pushed
+ *  @return 	   n/a
+ */
+void lbs_tx_trace_start(struct lbs_private *priv, struct sk_buff *skb)
+{
+	struct lbs_tx_trace *trace = &priv->tx_trace;
+	struct lbs_tx_trace_rec *rec;
+	unsigned long flags;
+
+	spin_lock_irqsave(&trace->lock, flags);
+	rec = &trace->ring[trace->next_seq % LBS_TX_TRACE_LEN];
+	memset(rec, 0, sizeof(*rec));
+	rec->seq = trace->next_seq++;
+	rec->len = skb->len;
+	rec->t[LBS_TX_STAGE_XMIT] = ktime_get();
+	rec->stamped = 1 << LBS_TX_STAGE_XMIT;
+	*(u32 *)skb->cb = rec->seq;
+	spin_unlock_irqrestore(&trace->lock, flags);
+}
+
+/**
+ *  @brief This function records that the frames first..last reached
+ *  a stage. Frames which already left the ring buffer are skipped.
+ *
+ *  @param priv    A pointer to struct lbs_private structure
+ *  @param first   Sequence number of the first frame
+ *  @param last    Sequence number of the last frame
+ *  @param stage   One of enum lbs_tx_stage
+ *  @return 	   n/a
+ */
+void lbs_tx_trace_stamp(struct lbs_private *priv, u32 first, u32 last,
+	int stage)
+{
+	struct lbs_tx_trace *trace = &priv->tx_trace;
+	struct lbs_tx_trace_rec *rec;
+	ktime_t now = ktime_get();
+	unsigned long flags;
+	u32 seq;
+
+	spin_lock_irqsave(&trace->lock, flags);
+	for (seq = first; (s32)(last - seq) >= 0; seq++) {
+		rec = &trace->ring[seq % LBS_TX_TRACE_LEN];
+		if (rec->seq != seq || (rec->stamped & (1 << stage)))
+			continue;
+
+		rec->t[stage] = now;
+		rec->stamped |= 1 << stage;
+		if (stage && (rec->stamped & (1 << (stage - 1))))
+			lbs_hist_add(&trace->stage[stage],
+				lbs_usecs_between(rec->t[stage - 1], now));
+		if (stage == LBS_TX_STAGE_DONE)
+			lbs_hist_add(&trace->total, lbs_usecs_between(
+				rec->t[LBS_TX_STAGE_XMIT], now));
+	}
+	if (stage == LBS_TX_STAGE_WRITTEN &&
+	    (s32)(last + 1 - trace->written_seq) > 0)
+		trace->written_seq = last + 1;
+	spin_unlock_irqrestore(&trace->lock, flags);
+}
+EXPORT_SYMBOL_GPL(lbs_tx_trace_stamp);
+
+/**
+ *  @brief This function records the DONE stage for the frames written
+ *  since the last download interrupt. Only one download is in flight
+ *  at a time, so they are the ones the card just acknowledged.
+ *
+ *  @param priv    A pointer to struct lbs_private structure
+ *  @return 	   n/a
+ */
+void lbs_tx_trace_done(struct lbs_private *priv)
+{
+	struct lbs_tx_trace *trace = &priv->tx_trace;
+	unsigned long flags;
+	u32 first, last;
+
+	spin_lock_irqsave(&trace->lock, flags);
+	first = trace->done_seq;
+	last = trace->written_seq - 1;
+	trace->done_seq = trace->written_seq;
+	spin_unlock_irqrestore(&trace->lock, flags);
+
+	if (first != last + 1)
+		lbs_tx_trace_stamp(priv, first, last, LBS_TX_STAGE_DONE);
+}
+
+/**
+ *  @brief These functions time the windows during which the net
+ *  queues are stopped.
+ *
+ *  @param priv    A pointer to struct lbs_private structure
+ *  @return 	   n/a
+ */
+void lbs_tx_trace_stop(struct lbs_private *priv)
+{
+	struct lbs_tx_trace *trace = &priv->tx_trace;
+	unsigned long flags;
+
+	spin_lock_irqsave(&trace->lock, flags);
+	if (!ktime_to_ns(trace->stopped_at))
+		trace->stopped_at = ktime_get();
+	spin_unlock_irqrestore(&trace->lock, flags);
+}
+
+void lbs_tx_trace_wake(struct lbs_private *priv)
+{
+	struct lbs_tx_trace *trace = &priv->tx_trace;
+	unsigned long flags;
+
+	spin_lock_irqsave(&trace->lock, flags);
+	if (ktime_to_ns(trace->stopped_at)) {
+		lbs_hist_add(&trace->stopped,
+			lbs_usecs_since(trace->stopped_at));
+		trace->stopped_at = ktime_set(0, 0);
+	}
+	spin_unlock_irqrestore(&trace->lock, flags);
+}
+#endif
@@ -811,6 +811,7 @@ static struct iw_statistics *lbs_get_wireless_stats(struct net_device *dev)
 	u8 rssi;
 	u32 tx_retries;
 	struct cmd_ds_802_11_get_log log;
+	int age;
 
 	lbs_deb_enter(LBS_DEB_WEXT);
 
@@ -854,9 +855,10 @@ static struct iw_statistics *lbs_get_wireless_stats(struct net_device *dev)
 	/* Quality by TX errors */
 	priv->wstats.discard.retries = priv->stats.tx_errors;
 
-	memset(&log, 0, sizeof(log));
-	log.hdr.size = cpu_to_le16(sizeof(log));
-	lbs_cmd_with_response(priv, CMD_802_11_GET_LOG, &log);
+	/* counters are refreshed in the background, see stats_interval */
+	age = lbs_get_cached_log(priv, &log);
+	if (age >= 0)
+		lbs_deb_wext("GET_LOG counters %d ms old\n", age);
 
 	tx_retries = le32_to_cpu(log.retry);
 
@@ -883,9 +885,6 @@ static struct iw_statistics *lbs_get_wireless_stats(struct net_device *dev)
 	priv->wstats.qual.updated = IW_QUAL_ALL_UPDATED | IW_QUAL_DBM;
 	stats_valid = 1;
 
-	/* update stats asynchronously for future calls */
-	lbs_prepare_and_send_command(priv, CMD_802_11_RSSI, 0,
-					0, 0, NULL);
 out:
 	if (!stats_valid) {
 		priv->wstats.miss.beacon = 0;